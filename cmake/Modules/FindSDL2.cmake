@@ -195,6 +195,6 @@ set(SDL2_INCLUDE_DIRS ${SDL2_INCLUDE_DIR})
 
 include(FindPackageHandleStandardArgs)
 
-FIND_PACKAGE_HANDLE_STANDARD_ARGS(SDL
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(SDL2
         REQUIRED_VARS SDL2_LIBRARY SDL2_INCLUDE_DIR
         VERSION_VAR SDL2_VERSION_STRING)
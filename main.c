@@ -34,77 +34,547 @@
 
 #include "src/vm.h"
 #include "src/debug.h"
+#include "src/timing.h"
+#include "src/audio.h"
 #include "libs/argtable3.h"
 
 
 #define PROGNAME "catastrophic-chip8"
 #define VERSION "1.0.0"
 
-#define NSECPERSEC    1000000000
 #define REGDECR_RATE  60 // rate in Hz at which timers should be decremented
 
+#define PIXEL_ON   0xFFFFFFFF // ARGB8888 colors of the display
+#define PIXEL_HALF 0xFF808080 // pixels set in only one of two blended frames
+#define PIXEL_OFF  0x00000000
+
+// options of the presentation stage
+#define PRESENT_VSYNC     (1u << 0u) // present in sync with the refresh of the host display
+#define PRESENT_DEFLICKER (1u << 1u) // blend the last two frames
+
+#define STATS_INTERVAL_SEC 5 // seconds between two timing reports in verbose mode
+
 
 static const int AUDIO_SAMPLE_RATE = 44100;
-static int AUDIO_FREQ;
-static int AUDIO_AMPLITUDE;
 
+#define AUDIO_BUFFER_SAMPLES 512 // samples per callback, about 12 ms
+#define SOUND_QUEUE_SIZE     64  // sound events in flight at most, a power of 2
+
+
+/*** Presentation ***************************************************************/
+
+
+#define FRAME_FRESH 4 // set in CH8_frame_handoff.middle while it holds an untaken frame
 
-//> Used in timing chip8 cpu cycles and timer decrements
-struct timespec
-time_diff(struct timespec start, struct timespec end)
+
+// Completed frames handed from the emulation thread to the main thread through a triple
+// buffer. Each side owns one slot, the third one is in between. Publishing or taking a
+// frame atomically swaps the own slot with the one in between, so neither side ever
+// waits for the other, and the main thread always gets the newest frame.
+typedef struct CH8_frame_handoff {
+    uint64_t     frames[3][CH8_VM_SCR_H]; // packed displays
+    SDL_atomic_t middle;  // slot in between, or'ed with FRAME_FRESH
+    int          writing; // slot owned by the emulation thread
+    int          reading; // slot owned by the main thread
+    Uint32       event;   // type of the SDL event waking the main thread for a frame
+} CH8_frame_handoff;
+
+
+//> Hands a copy of display to the main thread. Called by the emulation thread only.
+static void
+publish_frame(CH8_frame_handoff *handoff, const uint64_t *display)
 {
-    struct timespec temp;
-
-    if ((end.tv_nsec - start.tv_nsec) < 0) {
-        temp.tv_sec = end.tv_sec - start.tv_sec - 1;
-        temp.tv_nsec = 1000000000 + end.tv_nsec - start.tv_nsec;
-    } else {
-        temp.tv_sec = end.tv_sec - start.tv_sec;
-        temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+    memcpy(handoff->frames[handoff->writing], display, sizeof(handoff->frames[0]));
+    int middle = SDL_AtomicSet(&handoff->middle, handoff->writing | FRAME_FRESH);
+    handoff->writing = middle & 3;
+
+    // one event wakes the main thread for all frames published until it takes the
+    // newest one
+    if (!(middle & FRAME_FRESH)) {
+        SDL_Event e = { .type = handoff->event };
+        SDL_PushEvent(&e);
     }
+}
+
 
-    return temp;
+//> Returns the newest frame published since the last call, or NULL if there is none.
+//  Called by the main thread only.
+static const uint64_t *
+take_frame(CH8_frame_handoff *handoff)
+{
+    if (!(SDL_AtomicGet(&handoff->middle) & FRAME_FRESH))
+        return NULL;
+
+    handoff->reading = SDL_AtomicSet(&handoff->middle, handoff->reading) & 3;
+    return handoff->frames[handoff->reading];
 }
 
 
-//> Draws a framebuffer
+//> Draws the rows set in rows of display, blended with previous if it isn't NULL.
+//  Runs of adjacent rows are expanded to ARGB8888 pixels and uploaded to the texture as
+//  one sub-rectangle each, then the texture is presented.
 static void
 draw_framebuffer(
-        uint32_t *framebuffer, SDL_Texture *texture, SDL_Renderer *renderer)
+        const uint64_t *display, const uint64_t *previous, uint32_t rows,
+        SDL_Texture *texture, SDL_Renderer *renderer)
 {
-    SDL_UpdateTexture(texture, NULL, framebuffer,
-                      sizeof(framebuffer[0]) * CH8_VM_SCR_W);
+    // indexed by (pixel in display << 1) | pixel in previous. A pixel that is only set
+    // in one of the frames is drawn at half intensity.
+    static const uint32_t palette[4] = { PIXEL_OFF, PIXEL_HALF, PIXEL_HALF, PIXEL_ON };
+
+    uint32_t framebuffer[CH8_VM_SCR_W * CH8_VM_SCR_H];
+
+    while (rows)
+    {
+        int first = __builtin_ctz(rows);
+        int n     = __builtin_ctzll(~((uint64_t) rows >> first)); // length of the run
+        rows &= ~(uint32_t)(((1ull << n) - 1) << first);
+
+        SDL_Rect rect = { .x = 0, .y = first, .w = CH8_VM_SCR_W, .h = n };
+        CH8_VM_expand_rows(display, previous ? previous : display, first, n,
+                           framebuffer, palette);
+        SDL_UpdateTexture(texture, &rect, framebuffer,
+                          sizeof(framebuffer[0]) * CH8_VM_SCR_W);
+    }
+
     SDL_RenderClear(renderer);
     SDL_RenderCopy(renderer, texture, NULL, NULL);
     SDL_RenderPresent(renderer);
 }
 
 
-//> Callback function used to refill SDL audio buffer
+/*** Audio **********************************************************************/
+
+
+// Change of the sound output at a time in emulated samples, i.e. the frame the new
+// state starts with * AUDIO_SAMPLE_RATE / 60
+typedef struct CH8_sound_event {
+    uint64_t        time;
+    CH8_AUDIO_state state;
+} CH8_sound_event;
+
+
+// Sound events passed from the emulation thread to the audio callback through a single
+// producer, single consumer ring, so neither side ever waits for the other. The audio
+// device keeps running and renders silence while the sound is off.
+typedef struct CH8_sound_queue {
+    CH8_sound_event events[SOUND_QUEUE_SIZE];
+    SDL_atomic_t    head;     // next event written by the emulation thread
+    SDL_atomic_t    tail;     // next event read by the audio callback
+
+    // owned by the audio callback
+    CH8_AUDIO_synth synth;
+    uint64_t        played;   // samples rendered since the device was opened
+    int64_t         offset;   // sample of the device an event is played at - its time
+    int             anchored; // offset has been set
+    int64_t         delay;    // samples per buffer of the device, as obtained
+} CH8_sound_queue;
+
+
+//> Queues a change of the sound output. Returns 0 if the queue is full, so the event
+//  has to be pushed again later. Called by the emulation thread only.
+static int
+push_sound_event(CH8_sound_queue *queue, uint64_t time, const CH8_AUDIO_state *state)
+{
+    int head = SDL_AtomicGet(&queue->head);
+    if (head - SDL_AtomicGet(&queue->tail) == SOUND_QUEUE_SIZE)
+        return 0;
+
+    queue->events[head & (SOUND_QUEUE_SIZE - 1)] = (CH8_sound_event) { .time = time, .state = *state };
+    SDL_AtomicSet(&queue->head, head + 1);
+    return 1;
+}
+
+
+//> Callback function used to refill SDL audio buffer. Every sound event is rendered
+//  at the sample matching its emulated time, so beeps keep the length the sound timer
+//  gave them however the callbacks and frames interleave. Emulated time is mapped to
+//  the samples of the device with a delay of one buffer of the device, which is renewed
+//  whenever an event would have to be played in the past or too far ahead, e.g. after
+//  the emulation fell behind or slept.
 void audio_callback(void *user_data, Uint8 *raw_buffer, int bytes)
 {
-    Sint16 *buffer = (Sint16*) raw_buffer;
-    int length = bytes / 2; // 2 bytes per sample for AUDIO_S16SYS
-    int n_samples = (*(int*)user_data); // looks evil but works ...
+    CH8_sound_queue *queue = user_data;
+    int16_t *samples = (int16_t *) raw_buffer;
+    int64_t n_samples = bytes / 2; // 2 bytes per sample for AUDIO_S16SYS
+    int64_t done = 0;
+
+    int tail = SDL_AtomicGet(&queue->tail);
+    while (tail != SDL_AtomicGet(&queue->head))
+    {
+        const CH8_sound_event *event = &queue->events[tail & (SOUND_QUEUE_SIZE - 1)];
+        int64_t at = (int64_t) event->time + queue->offset - (int64_t) queue->played;
+
+        if (!queue->anchored || at < done || at > queue->delay + AUDIO_SAMPLE_RATE / 4) {
+            // never before the samples already rendered by this callback
+            int64_t anchor  = queue->delay > done ? queue->delay : done;
+            queue->offset   = (int64_t) queue->played + anchor - (int64_t) event->time;
+            queue->anchored = 1;
+            at = anchor;
+        }
+        if (at >= n_samples)
+            break; // played by a later callback
+
+        CH8_AUDIO_render(&queue->synth, samples + done, (size_t) (at - done));
+        CH8_AUDIO_set_state(&queue->synth, &event->state);
+        done = at;
+        SDL_AtomicSet(&queue->tail, ++tail);
+    }
+
+    CH8_AUDIO_render(&queue->synth, samples + done, (size_t) (n_samples - done));
+    queue->played += (uint64_t) n_samples;
+}
+
+
+/*** Input ************************************************************************/
+
+
+//  Keymap on original chip 8 machine (http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#2.3)
+//  +---+---+---+---+
+//  | 1 | 2 | 3 | C |
+//  +---+---+---+---+
+//  | 4 | 5 | 6 | D |
+//  +---+---+---+---+
+//  | 7 | 8 | 9 | E |
+//  +---+---+---+---+
+//  | A | 0 | B | F |
+//  +---+---+---+---+
+static const SDL_Keycode keymap[16] = {
+        SDLK_x,
+        SDLK_1,
+        SDLK_2,
+        SDLK_3,
+        SDLK_q,
+        SDLK_w,
+        SDLK_e,
+        SDLK_a,
+        SDLK_s,
+        SDLK_d,
+        SDLK_z,
+        SDLK_c,
+        SDLK_4,
+        SDLK_r,
+        SDLK_f,
+        SDLK_v,
+};
+
+
+// Keys and commands passed from the main thread, which receives all SDL events, to the
+// emulation thread
+typedef struct CH8_input {
+    SDL_atomic_t keys;    // bit k is set while key k is held
+    SDL_atomic_t pressed; // bit k is set if key k has been pressed since the last take
+    SDL_atomic_t command; // CH8_VM_QUIT, CH8_VM_RELOAD or CH8_VM_CPU_DUMP until taken
+    SDL_sem     *changed; // posted after every change, wakes a vm waiting for a key
+} CH8_input;
+
+
+//> Passes keys and special keys of an SDL event to the emulation thread. Returns
+//  whether the program has to quit. Called by the main thread only.
+static int
+handle_event(CH8_input *input, const SDL_Event *e)
+{
+    int command = CH8_VM_SUCCESS;
+    int keys    = SDL_AtomicGet(&input->keys); // not written by any other thread
+
+    if (e->type == SDL_QUIT)
+        command = CH8_VM_QUIT;
+
+    // process keydown events
+    else if (e->type == SDL_KEYDOWN)
+    {
+        if (e->key.keysym.sym == SDLK_ESCAPE)
+            command = CH8_VM_QUIT;
+
+        if (e->key.keysym.sym == SDLK_F1)
+            command = CH8_VM_RELOAD;
+
+        if (e->key.keysym.sym == SDLK_F2)
+            command = CH8_VM_CPU_DUMP;
+
+        for (int i = 0; i < 16; ++i)
+            if (e->key.keysym.sym == keymap[i]) {
+                keys |= 1 << i;
+                // taps shorter than a frame are still seen by the vm
+                int pressed = SDL_AtomicGet(&input->pressed);
+                while (!SDL_AtomicCAS(&input->pressed, pressed, pressed | 1 << i))
+                    pressed = SDL_AtomicGet(&input->pressed);
+            }
+    }
+
+    // process keyup events
+    else if (e->type == SDL_KEYUP)
+    {
+        for (int i = 0; i < 16; ++i)
+            if (e->key.keysym.sym == keymap[i])
+                keys &= ~(1 << i);
+    }
+    else
+        return 0;
+
+    SDL_AtomicSet(&input->keys, keys);
+    if (command != CH8_VM_SUCCESS)
+        SDL_AtomicSet(&input->command, command);
+    SDL_SemPost(input->changed);
+    return command == CH8_VM_QUIT;
+}
+
+
+//> Sets the keypad of the vm to the keys held and returns the command given since the
+//  last call. Keys pressed since the last call stay pressed until the next one, even if
+//  they have been released already. Called by the emulation thread only.
+static int
+take_input(CH8_input *input, CH8_VM *vm)
+{
+    int pressed = SDL_AtomicSet(&input->pressed, 0);
+    int keys    = SDL_AtomicGet(&input->keys);
+
+    CH8_VM_set_keypad(vm, (uint16_t) keys, (uint16_t) pressed);
+
+    return SDL_AtomicSet(&input->command, CH8_VM_SUCCESS);
+}
+
+
+/*** Emulation ********************************************************************/
+
+
+// State shared by the main thread and the emulation thread
+typedef struct CH8_emulation_ctx {
+    CH8_VM            *vm;        // owned by the emulation thread while it runs
+    const char        *rom_fpath;
+    uint32_t           vm_opts;
+    size_t             clock_freq;
+    uint32_t           max_catchup;
+    uint64_t           seed;
+
+    CH8_frame_handoff  handoff;
+    CH8_input          input;
+    CH8_sound_queue    sound;
+} CH8_emulation_ctx;
+
+
+//> Main emulation loop of chip8, run by the emulation thread. Each 60 Hz frame, the
+//  instructions of the frame are executed in one batch and the timers are decremented,
+//  then the thread sleeps until the next frame is due. Frames missed because the host
+//  fell behind are caught up on, up to max_catchup frames at once. Whatever the
+//  instructions drew, the display is handed to the main thread at most once per frame.
+//  The vm draws random numbers from seed, also after it has been reloaded. Pushes an
+//  SDL_QUIT event once it stops, so the main thread stops as well.
+static int
+CH8_emulation_loop(void *data)
+{
+    CH8_emulation_ctx *ctx = data;
+    CH8_VM *vm = ctx->vm;
+
+    int main_rc = 0; // return code to main loop
+    int temp_rc = 0; // temporary variable to hold return code of any function
+
+    CH8_AUDIO_state sound_state = { .on = 0 }; // last state queued
+
+    CH8_TIMING_pacer pacer;
+    CH8_TIMING_pacer_init(&pacer, REGDECR_RATE, ctx->max_catchup);
+
+    uint64_t shown[CH8_VM_SCR_H] = { 0 }; // display as last handed to the main thread
+
+    CH8_TIMING_stats stats;
+    CH8_TIMING_stats_reset(&stats, CH8_TIMING_now_ns());
+    uint64_t frame = 0;
+
+    while (1)
+    {
+        uint64_t dropped = pacer.dropped;
+        uint32_t due = CH8_TIMING_pacer_due(&pacer);
+        stats.dropped += pacer.dropped - dropped;
+
+        for (uint32_t i = 0; i < due; i++, frame++)
+        {
+            // run cpufreq / 60 instructions per frame, spreading the remainder of the
+            // division over the frames
+            uint64_t n_cycles = (frame + 1) * ctx->clock_freq / REGDECR_RATE -
+                                frame * ctx->clock_freq / REGDECR_RATE;
+            uint64_t before = vm->cycles + vm->skipped_cycles;
+
+            temp_rc = CH8_VM_run_frame(vm, n_cycles);
+            if (temp_rc == CH8_VM_UNSUPPORTED_OPCODE) {
+                main_rc = EX_SOFTWARE;
+                goto QUIT;
+            }
+
+            stats.cycles += vm->cycles + vm->skipped_cycles - before;
+            stats.timer_ticks++;
+
+            // the sound output after the timers have been decremented lasts from the
+            // next frame on
+            CH8_AUDIO_state state;
+            CH8_AUDIO_get_state(vm, &state);
+            if (memcmp(&state, &sound_state, sizeof(state)) != 0 &&
+                push_sound_event(&ctx->sound, (frame + 1) * AUDIO_SAMPLE_RATE / REGDECR_RATE, &state))
+                sound_state = state;
+        }
+
+        // frames are only handed over if the display has changed. The main thread
+        // redraws the rows that changed.
+        if (CH8_VM_changed_rows(vm, shown))
+            publish_frame(&ctx->handoff, shown);
+
+        temp_rc = take_input(&ctx->input, vm);
+        switch (temp_rc) {
+            case CH8_VM_QUIT:
+                if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
+                {
+                    CH8_VM_DBG_log(__func__, "quit after %llu instructions, %llu skipped while idle, "
+                                   "%llu frames dropped\n",
+                                   (unsigned long long) vm->cycles,
+                                   (unsigned long long) vm->skipped_cycles,
+                                   (unsigned long long) pacer.dropped);
+                    CH8_TIMING_stats_log(&stats, CH8_TIMING_now_ns(), ctx->clock_freq, REGDECR_RATE);
+                }
+                goto QUIT;
+
+            case CH8_VM_RELOAD:
+                CH8_VM_kill(vm);
+                vm = ctx->vm = CH8_VM_init(ctx->vm_opts);
+                CH8_VM_seed(vm, ctx->seed);
+                CH8_VM_load_rom(vm, ctx->rom_fpath);
+
+                if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
+                    CH8_VM_DBG_log(__func__, "vm reloaded\n");
+                break;
+
+            case CH8_VM_CPU_DUMP:
+                if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
+                    CH8_VM_DBG_output_cpu_dump(__func__, vm, "CPU dump requested\n");
+                break;
+
+            default:
+                break;
+        }
+
+        if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
+        {
+            uint64_t now = CH8_TIMING_now_ns();
+            if (now - stats.since_ns >= STATS_INTERVAL_SEC * CH8_TIMING_NSEC_PER_SEC) {
+                CH8_TIMING_stats_log(&stats, now, ctx->clock_freq, REGDECR_RATE);
+                CH8_TIMING_stats_reset(&stats, now);
+            }
+        }
+
+        if (CH8_VM_is_waiting_for_key(vm) &&
+            vm->cpu.delay_timer == 0 && vm->cpu.sound_timer == 0)
+        {
+            // no timer to decrement, nothing happens until the next input. The frames
+            // slept through are accounted as idle instead of being caught up on.
+            uint64_t slept = CH8_TIMING_now_ns();
+            SDL_SemWait(ctx->input.changed);
+            slept = CH8_TIMING_now_ns() - slept;
+
+            uint64_t skipped = slept * ctx->clock_freq / CH8_TIMING_NSEC_PER_SEC;
+            vm->skipped_cycles += skipped;
+            stats.cycles       += skipped;
+            stats.timer_ticks  += slept * REGDECR_RATE / CH8_TIMING_NSEC_PER_SEC;
+
+            CH8_TIMING_pacer_reset(&pacer);
+        }
+        else
+        {
+            CH8_TIMING_pacer_wait(&pacer);
+        }
+    }
+
+    QUIT:
+    {
+        SDL_Event e = { .type = SDL_QUIT };
+        SDL_PushEvent(&e);
+    }
+    return main_rc;
+}
+
+
+//> Presents the frames published by the emulation thread and passes input to it until
+//  the program has to quit. SDL only supports rendering and receiving events on the
+//  main thread, so the emulation runs on a thread of its own, which a slow
+//  SDL_RenderPresent (e.g. waiting for vsync) never delays.
+static void
+CH8_present_loop(CH8_emulation_ctx *ctx, SDL_Renderer *renderer, SDL_Texture *texture,
+                 uint32_t present_opts)
+{
+    uint64_t shown[CH8_VM_SCR_H]    = { 0 }; // display as last presented
+    uint64_t previous[CH8_VM_SCR_H] = { 0 }; // display presented before, for blending
+    uint32_t blended_rows = 0;                // rows that changed in the last frame
+    uint32_t stale_rows   = 0xFFFFFFFF;       // the texture starts out undefined
 
-    for (int i = 0; i < length; i++, n_samples++)
+    int quit = 0;
+    while (!quit)
     {
-        double time = (double)n_samples / (double) AUDIO_SAMPLE_RATE;
-        buffer[i] = (Sint16)(AUDIO_AMPLITUDE * sin(2.0f * M_PI * (double) AUDIO_FREQ * time));
+        // a blended frame has to be redrawn unblended if no new frame follows it
+        SDL_Event e;
+        int got = blended_rows ? SDL_WaitEventTimeout(&e, 1000 / REGDECR_RATE + 1)
+                               : SDL_WaitEvent(&e);
+        if (!got && !blended_rows) {
+            SDL_Log("Unable to wait for events: %s", SDL_GetError());
+            break;
+        }
+
+        // events and frames published meanwhile are handled at once
+        for (; got && !quit; got = SDL_PollEvent(&e))
+            quit = handle_event(&ctx->input, &e);
+
+        uint32_t rows = 0;
+        const uint64_t *frame = take_frame(&ctx->handoff);
+
+        memcpy(previous, shown, sizeof(shown));
+        for (int row = 0; frame && row < CH8_VM_SCR_H; row++) {
+            if (frame[row] != shown[row]) {
+                shown[row] = frame[row];
+                rows |= 1u << row;
+            }
+        }
+
+        if (present_opts & PRESENT_DEFLICKER)
+        {
+            // rows that changed in the last frame change again once that frame becomes
+            // the previous one
+            if (rows | blended_rows | stale_rows)
+                draw_framebuffer(shown, previous, rows | blended_rows | stale_rows,
+                                 texture, renderer);
+            blended_rows = rows;
+        }
+        else if (rows | stale_rows)
+        {
+            draw_framebuffer(shown, NULL, rows | stale_rows, texture, renderer);
+        }
+        stale_rows = 0;
     }
 }
 
 
-//> Main emulation loop of chip8. Its pretty heavy on the CPU thread as th thread is
-//  not put into sleep mode while timing chip8 CPU cycles and timer decrements.
+//> Sets up SDL and the vm, runs the emulation thread and presents its frames on the
+//  main thread until the program has to quit.
 static int
-CH8_emulation_loop(
-        const char *rom_fpath, uint32_t vm_opts, int32_t video_scale,
-        size_t clock_freq, int audio_freq, int audio_ampl)
+CH8_run(const char *rom_fpath, uint32_t vm_opts, int32_t video_scale,
+        size_t clock_freq, int audio_freq, int audio_ampl, uint32_t max_catchup,
+        uint32_t present_opts, uint64_t seed)
 {
     int main_rc = 0; // return code to main loop
     int temp_rc = 0; // temporary variable to hold return code of any function
 
+    // released at QUIT, as far as they have been set up
+    SDL_Window   *window    = NULL;
+    SDL_Renderer *renderer  = NULL;
+    SDL_Texture  *texture   = NULL;
+    SDL_Thread   *emulation = NULL;
+
+    // large and shared with the other threads, so not on the stack
+    static CH8_emulation_ctx ctx;
+    ctx = (CH8_emulation_ctx) {
+            .rom_fpath   = rom_fpath,
+            .vm_opts     = vm_opts,
+            .clock_freq  = clock_freq,
+            .max_catchup = max_catchup,
+            .seed        = seed,
+            .handoff     = { .writing = 0, .reading = 1, .middle = { 2 } }
+    };
+
     /*** Set up SDL */
 
     temp_rc = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO); // todo: debug memory leaks
@@ -114,32 +584,40 @@ CH8_emulation_loop(
         goto QUIT;
     }
 
-    SDL_Window *window = SDL_CreateWindow(
+    window = SDL_CreateWindow(
             PROGNAME, 0, 0,
             CH8_VM_SCR_W * video_scale, CH8_VM_SCR_H * video_scale,
             SDL_WINDOW_SHOWN);
 
-    SDL_Renderer *renderer = SDL_CreateRenderer(
+    renderer = SDL_CreateRenderer(
             window, -1,
-            SDL_RENDERER_ACCELERATED);
+            SDL_RENDERER_ACCELERATED |
+            ((present_opts & PRESENT_VSYNC) ? SDL_RENDERER_PRESENTVSYNC : 0u));
 
-    SDL_Texture *texture = SDL_CreateTexture(
+    texture = SDL_CreateTexture(
             renderer,
             SDL_PIXELFORMAT_ARGB8888,
             SDL_TEXTUREACCESS_STREAMING,
             CH8_VM_SCR_W, CH8_VM_SCR_H);
 
-    AUDIO_FREQ        = audio_freq;
-    AUDIO_AMPLITUDE   = audio_ampl;
+    ctx.handoff.event  = SDL_RegisterEvents(1);
+    ctx.input.changed  = SDL_CreateSemaphore(0);
+    if (window == NULL || renderer == NULL || texture == NULL ||
+        ctx.handoff.event == (Uint32) -1 || ctx.input.changed == NULL) {
+        SDL_Log("Unable to set up the display: %s", SDL_GetError());
+        main_rc = EX_TEMPFAIL;
+        goto QUIT;
+    }
+
+    CH8_AUDIO_synth_init(&ctx.sound.synth, AUDIO_SAMPLE_RATE, audio_freq, audio_ampl);
 
-    int n_samples = 0;
     SDL_AudioSpec want_spec = {
             .freq     = AUDIO_SAMPLE_RATE,
             .format   = AUDIO_S16SYS,   // sample type (signed short i.e. 16 bit)
             .channels = 1,              // only one channel
-            .samples  = 5000,           // buffer-size
+            .samples  = AUDIO_BUFFER_SAMPLES, // buffer-size
             .callback = audio_callback, // function SDL calls periodically to refill the buffer
-            .userdata = &n_samples      // counter keeping track of current sample number
+            .userdata = &ctx.sound      // sound events and the square wave played
     };
 
     SDL_AudioSpec have_spec;
@@ -155,11 +633,14 @@ CH8_emulation_loop(
         main_rc = EX_TEMPFAIL;
         goto QUIT;
     }
+    ctx.sound.delay = have_spec.samples; // the device may use another buffer size
+    SDL_PauseAudio(0); // the device keeps running, silence is rendered while the sound is off
 
     /*** Beginning of emulation */
 
-    CH8_VM *vm = CH8_VM_init(vm_opts);
-    temp_rc = CH8_VM_load_rom(vm, rom_fpath);
+    ctx.vm = CH8_VM_init(vm_opts);
+    CH8_VM_seed(ctx.vm, seed);
+    temp_rc = CH8_VM_load_rom(ctx.vm, rom_fpath);
 
     if (temp_rc == CH8_VM_ROMSIZE_OUTOFBOUNDS) {
         main_rc = EX_DATAERR;
@@ -169,77 +650,33 @@ CH8_emulation_loop(
         goto QUIT;
     }
 
-    struct timespec t1_clockfreq = {.tv_sec = 0, .tv_nsec = 0};
-    struct timespec t2_clockfreq = {.tv_sec = 0, .tv_nsec = 0};
-
-    struct timespec t1_regdecr   = {.tv_sec = 0, .tv_nsec = 0};
-    struct timespec t2_regdecr   = {.tv_sec = 0, .tv_nsec = 0};
-
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1_clockfreq);
-    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1_regdecr);
-
-    while (1)
-    {
-        if (vm->cpu->sound_timer > 0) { SDL_PauseAudio(0); } // ugly but it works
-        else if (vm->cpu->sound_timer == 0) { SDL_PauseAudio(1); }
-
-        if (time_diff(t1_regdecr, t2_regdecr).tv_nsec > NSECPERSEC / REGDECR_RATE)
-        {
-            CH8_VM_decrement_timers(vm);
-            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1_regdecr);
-        }
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t2_regdecr);
-
-        if (time_diff(t1_clockfreq, t2_clockfreq).tv_nsec > NSECPERSEC / clock_freq)
-        {
-            temp_rc = CH8_VM_emulate_cycle(vm);
-            if (temp_rc == CH8_VM_UNSUPPORTED_OPCODE) {
-                main_rc = EX_SOFTWARE;
-                goto QUIT;
-            }
-
-            if (CH8_VM_is_drawflag_set(vm))
-            {
-                draw_framebuffer(vm->framebuffer, texture, renderer);
-                CH8_VM_unset_drawflag(vm);
-            }
-
-            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t1_clockfreq);
-        }
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t2_clockfreq);
-
-        temp_rc = CH8_VM_SDL_set_keys(vm);
-        switch (temp_rc) {
-            case CH8_VM_QUIT:
-                if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
-                    CH8_VM_DBG_log(__func__, "quit\n");
-                goto QUIT;
-
-            case CH8_VM_RELOAD:
-                CH8_VM_kill(vm);
-                vm = CH8_VM_init(vm_opts);
-                CH8_VM_load_rom(vm, rom_fpath);
-
-                if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
-                    CH8_VM_DBG_log(__func__, "vm reloaded\n");
-                break;
-
-            case CH8_VM_CPU_DUMP:
-                if (vm->opt_flags & CH8_VM_VERBOSE_MODE)
-                    CH8_VM_DBG_output_cpu_dump(__func__, vm, "CPU dump requested\n");
-                break;
-
-            default:
-                break;
-        }
+    emulation = SDL_CreateThread(CH8_emulation_loop, "emulation", &ctx);
+    if (emulation == NULL) {
+        SDL_Log("Unable to start the emulation: %s", SDL_GetError());
+        main_rc = EX_OSERR;
+        goto QUIT;
     }
 
-    QUIT:
-    CH8_VM_kill(vm);
+    CH8_present_loop(&ctx, renderer, texture, present_opts);
 
-    SDL_DestroyWindow(window);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyTexture(texture);
+    QUIT:
+    if (emulation) {
+        // the emulation thread may still run if the main thread quit first
+        SDL_AtomicSet(&ctx.input.command, CH8_VM_QUIT);
+        SDL_SemPost(ctx.input.changed);
+        SDL_WaitThread(emulation, &main_rc);
+    }
+    if (ctx.vm)
+        CH8_VM_kill(ctx.vm);
+    if (ctx.input.changed)
+        SDL_DestroySemaphore(ctx.input.changed);
+
+    if (texture)
+        SDL_DestroyTexture(texture);
+    if (renderer)
+        SDL_DestroyRenderer(renderer);
+    if (window)
+        SDL_DestroyWindow(window);
     SDL_CloseAudio();
 
     SDL_Quit();
@@ -251,8 +688,8 @@ CH8_emulation_loop(
 /*** Command line parsing **********************************************************/
 
 
-struct arg_lit *help, *version, *verbose_mode, *original_mode;
-struct arg_int *clockfreq, *vidscale, *beepfreq, *ampl;
+struct arg_lit *help, *version, *verbose_mode, *original_mode, *vsync, *deflicker;
+struct arg_int *clockfreq, *vidscale, *beepfreq, *ampl, *maxcatchup, *seed;
 struct arg_file *rom_fspec;
 struct arg_end *end;
 
@@ -283,6 +720,18 @@ main(int argc, char **argv)
             ampl          = arg_intn(NULL, "ampl","<int>",
                     0, 1, "amplitude of single chip8 sound (defaults to 20000)"),
 
+            vsync         = arg_litn(NULL, "vsync",
+                    0, 1, "present frames in sync with the refresh rate of the display"),
+
+            deflicker     = arg_litn(NULL, "deflicker",
+                    0, 1, "reduce flicker by blending the last two frames"),
+
+            maxcatchup    = arg_intn(NULL, "maxcatchup", "<int>",
+                    0, 1, "frames caught up on at once when lagging behind (defaults to 4)"),
+
+            seed          = arg_intn(NULL, "seed", "<int>",
+                    0, 1, "seed of the random numbers drawn by the rom (defaults to the time)"),
+
             verbose_mode  = arg_litn("v", "verbose",
                     0, 1, "verbose mode of emulator"),
 
@@ -304,6 +753,9 @@ main(int argc, char **argv)
     // set frequency default value to 440 Hz
     beepfreq->ival[0]      = 440;
 
+    // set max catch-up default value to 4 frames
+    maxcatchup->ival[0] = 4;
+
     int nerrors;
     nerrors = arg_parse(argc, argv, argtable);
 
@@ -340,13 +792,17 @@ main(int argc, char **argv)
     uint32_t opts = ((verbose_mode->count == 1) ? CH8_VM_VERBOSE_MODE : 0u) |
                     ((original_mode->count == 1) ? CH8_VM_ORIGINAL_IMPL : 0u);
 
-    exitcode = CH8_emulation_loop(
+    exitcode = CH8_run(
             rom_fspec->filename[0],
             opts,
             vidscale->ival[0],
             clockfreq->ival[0],
             beepfreq->ival[0],
-            ampl->ival[0]);
+            ampl->ival[0],
+            maxcatchup->ival[0] > 0 ? (uint32_t) maxcatchup->ival[0] : 1u,
+            ((vsync->count == 1) ? PRESENT_VSYNC : 0u) |
+            ((deflicker->count == 1) ? PRESENT_DEFLICKER : 0u),
+            (seed->count == 1) ? (uint64_t) (uint32_t) seed->ival[0] : (uint64_t) time(NULL));
 
     EXIT:
     arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
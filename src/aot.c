@@ -0,0 +1,82 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include "aot.h"
+
+#include <string.h>
+
+
+//> Copies the rom of a translated program into memory. The vm runs the translation
+//  until the rom overwrites its own code.
+void
+CH8_AOT_load(CH8_VM *vm, const CH8_AOT_program *program)
+{
+    CH8_VM_load_rom_buffer(vm, program->rom, program->rom_size);
+    vm->internal_flags &= ~CH8_VM_AOT_STALE;
+}
+
+
+//> Returns whether the memory range [addr, addr + len) overlaps translated code.
+int
+CH8_AOT_touches_code(const CH8_AOT_program *program, uint16_t addr, uint16_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t a = (addr + i) & 0x0FFFu; // stores wrap around the end of memory
+        if (program->is_code[a >> 3u] & (1u << (a & 7u)))
+            return 1;
+    }
+    return 0;
+}
+
+
+//> Marks the translation of a vm as stale if a store to [addr, addr + len) has
+//  overwritten translated code.
+void
+CH8_AOT_check_store(CH8_VM *vm, const CH8_AOT_program *program,
+                    uint16_t addr, uint16_t len)
+{
+    if (CH8_AOT_touches_code(program, addr, len))
+        vm->internal_flags |= CH8_VM_AOT_STALE;
+}
+
+
+//> Executes the instruction at the program counter with the interpreter, for code
+//  the translation does not cover.
+int
+CH8_AOT_interpret(CH8_VM *vm, const CH8_AOT_program *program)
+{
+    uint16_t pc = vm->cpu.pc;
+    uint16_t I  = vm->cpu.I;
+    uint16_t opcode = (uint16_t)(vm->mem[pc & 0x0FFFu] << 8u | vm->mem[(pc + 1) & 0x0FFFu]);
+
+    int rc = CH8_VM_emulate_cycle(vm);
+
+    // the interpreter only invalidates its own caches
+    if ((opcode & 0xF0FFu) == 0xF033)
+        CH8_AOT_check_store(vm, program, I, 3);
+    else if ((opcode & 0xF0FFu) == 0xF055)
+        CH8_AOT_check_store(vm, program, I, ((opcode & 0x0F00u) >> 8u) + 1);
+    return rc;
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_AOT_H
+#define CATASTROPHIC_CHIP8_AOT_H
+
+#include "vm.h"
+
+
+// A rom translated to C ahead of time by catastrophic_chip8_aot. The translation
+// executes the rom as loaded; addresses it has no code for are interpreted, and once
+// the rom overwrites translated code the whole rom is interpreted.
+typedef struct CH8_AOT_program {
+    const char    *name;
+    const uint8_t *rom;
+    uint16_t       rom_size;
+
+    // one bit per memory byte that is part of a translated instruction
+    const uint8_t *is_code;
+
+    // Executes exactly n_cycles instructions like CH8_VM_run, returning early once the
+    // rom is idle
+    int (*run)(CH8_VM *vm, uint64_t n_cycles);
+} CH8_AOT_program;
+
+
+void CH8_AOT_load(CH8_VM *vm, const CH8_AOT_program *program);
+
+int  CH8_AOT_touches_code(const CH8_AOT_program *program, uint16_t addr, uint16_t len);
+
+void CH8_AOT_check_store(CH8_VM *vm, const CH8_AOT_program *program,
+                         uint16_t addr, uint16_t len);
+
+int  CH8_AOT_interpret(CH8_VM *vm, const CH8_AOT_program *program);
+
+#endif //CATASTROPHIC_CHIP8_AOT_H
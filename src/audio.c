@@ -0,0 +1,287 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include "audio.h"
+
+#include <math.h>
+#include <string.h>
+
+
+#define PATTERN_SHIFT 25u // 2^32 / CH8_AUDIO_PATTERN_BITS phase per bit of a pattern
+#define PATTERN_FRAC  ((1u << PATTERN_SHIFT) - 1u)
+
+
+//> Sets up a square wave of freq Hz sampled at sample_rate Hz. The amplitude is
+//  clamped to the range of 16-bit samples. The sound starts switched off.
+void
+CH8_AUDIO_synth_init(CH8_AUDIO_synth *synth, uint32_t sample_rate, uint32_t freq,
+                     int32_t amplitude)
+{
+    if (amplitude < 0)
+        amplitude = 0;
+    if (amplitude > INT16_MAX)
+        amplitude = INT16_MAX;
+
+    memset(synth, 0x00, sizeof(CH8_AUDIO_synth));
+    synth->step        = sample_rate ? (uint32_t) (((uint64_t) freq << 32u) / sample_rate) : 0;
+    synth->sample_rate = sample_rate;
+    synth->amplitude   = (int16_t) amplitude;
+}
+
+
+//> Switches the sound on or off. Every beep starts at the beginning of a period, so
+//  beeps of the same length render the same samples.
+void
+CH8_AUDIO_set_sound(CH8_AUDIO_synth *synth, int on)
+{
+    if (on && !synth->on)
+        synth->phase = 0;
+    synth->on = on ? 1 : 0;
+}
+
+
+//> Returns the sound output of a vm.
+void
+CH8_AUDIO_get_state(const CH8_VM *vm, CH8_AUDIO_state *state)
+{
+    memcpy(state->pattern, vm->audio_pattern, sizeof(state->pattern));
+    state->pitch       = vm->pitch;
+    state->use_pattern = vm->internal_flags & CH8_VM_AUDIO_PATTERN ? 1 : 0;
+    state->on          = CH8_VM_is_sound_on(vm);
+}
+
+
+//> Takes over the sound output of a vm. The tables of a pattern are only rebuilt when
+//  the pattern or the pitch changed.
+void
+CH8_AUDIO_set_state(CH8_AUDIO_synth *synth, const CH8_AUDIO_state *state)
+{
+    if (state->use_pattern && (!synth->use_pattern || synth->pitch != state->pitch ||
+                               memcmp(synth->pattern, state->pattern, sizeof(synth->pattern))))
+    {
+        memcpy(synth->pattern, state->pattern, sizeof(synth->pattern));
+        for (int i = 0; i < CH8_AUDIO_PATTERN_BITS; i++) {
+            synth->bits[i]     = (state->pattern[i >> 3] >> (7 - (i & 7))) & 1u;
+            synth->ones[i + 1] = synth->ones[i] + synth->bits[i];
+        }
+
+        double rate = 4000.0 * pow(2.0, (state->pitch - 64) / 48.0); // bits per second
+        double step = rate * (double) (1u << PATTERN_SHIFT) / synth->sample_rate;
+        synth->pitch        = state->pitch;
+        synth->pattern_step = step < 1.0 ? 1u : step > (double) UINT32_MAX ? UINT32_MAX : (uint32_t) step;
+        synth->scale        = ((int64_t) synth->amplitude << 32u) / synth->pattern_step;
+    }
+    synth->use_pattern = state->use_pattern;
+
+    CH8_AUDIO_set_sound(synth, state->on);
+}
+
+
+//> Returns the number of set bits of the pattern before phase, in units of phase.
+static inline uint64_t
+pattern_integral(const CH8_AUDIO_synth *synth, uint32_t phase)
+{
+    uint32_t bit = phase >> PATTERN_SHIFT;
+    return ((uint64_t) synth->ones[bit] << PATTERN_SHIFT) +
+           (synth->bits[bit] ? phase & PATTERN_FRAC : 0u);
+}
+
+
+//> Fills a buffer with the next n_samples samples of the audio pattern. A sample is
+//  +amplitude where the pattern is set and -amplitude where it isn't, averaged over
+//  the interval it stands for, which suppresses most of the aliasing of picking the
+//  nearest bit.
+static void
+render_pattern(CH8_AUDIO_synth *synth, int16_t *samples, size_t n_samples)
+{
+    uint32_t phase = synth->phase;
+    uint32_t step  = synth->pattern_step;
+    uint64_t total = (uint64_t) synth->ones[CH8_AUDIO_PATTERN_BITS] << PATTERN_SHIFT;
+
+    for (size_t i = 0; i < n_samples; i++) {
+        uint32_t next = phase + step;
+        uint64_t set  = pattern_integral(synth, next) - pattern_integral(synth, phase) +
+                        (next < phase ? total : 0u); // the pattern wrapped around
+
+        samples[i] = (int16_t) (((int64_t) (2 * set) - step) * synth->scale / ((int64_t) 1 << 32u));
+        phase = next;
+    }
+    synth->phase = phase;
+}
+
+
+//> Fills a buffer with the next n_samples samples of the sound, or with silence while
+//  it is off. The high bit of the phase selects the half of the period of the beep, so
+//  its loop has no branches and is vectorized by the compiler.
+void
+CH8_AUDIO_render(CH8_AUDIO_synth *synth, int16_t *samples, size_t n_samples)
+{
+    if (!synth->on) {
+        memset(samples, 0x00, n_samples * sizeof(int16_t));
+        return;
+    }
+    if (synth->use_pattern) {
+        render_pattern(synth, samples, n_samples);
+        return;
+    }
+
+    uint32_t phase = synth->phase;
+    uint32_t step  = synth->step;
+    int32_t  amplitude = synth->amplitude;
+
+    for (size_t i = 0; i < n_samples; i++) {
+        int32_t low = -(int32_t) ((phase + (uint32_t) i * step) >> 31u); // 0 or -1
+        samples[i] = (int16_t) ((amplitude ^ low) - low);
+    }
+    synth->phase = phase + (uint32_t) n_samples * step;
+}
+
+
+/*** Recording ********************************************************************/
+
+
+#define WAV_HEADER_SIZE 44
+
+
+//> Stores v at p in little endian byte order.
+static void
+put_le(uint8_t *p, uint32_t v, int n_bytes)
+{
+    for (int i = 0; i < n_bytes; i++)
+        p[i] = (uint8_t) (v >> (8u * i));
+}
+
+
+//> Writes the header of a 16-bit mono WAV file holding n_samples samples.
+static int
+write_wav_header(FILE *out, uint32_t sample_rate, uint64_t n_samples)
+{
+    uint64_t data_size = n_samples * 2;
+    uint32_t data = data_size > UINT32_MAX - WAV_HEADER_SIZE ? UINT32_MAX - WAV_HEADER_SIZE
+                                                             : (uint32_t) data_size;
+    uint8_t header[WAV_HEADER_SIZE];
+
+    memcpy(header, "RIFF", 4);
+    put_le(header + 4, data + WAV_HEADER_SIZE - 8, 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le(header + 16, 16, 4);              // size of the format chunk
+    put_le(header + 20, 1, 2);               // PCM
+    put_le(header + 22, 1, 2);               // mono
+    put_le(header + 24, sample_rate, 4);
+    put_le(header + 28, sample_rate * 2, 4); // bytes per second
+    put_le(header + 32, 2, 2);               // bytes per sample
+    put_le(header + 34, 16, 2);              // bits per sample
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, data, 4);
+
+    return fwrite(header, 1, WAV_HEADER_SIZE, out) == WAV_HEADER_SIZE ? 0 : -1;
+}
+
+
+//> Writes the buffered samples of a recorder to its output.
+static void
+flush_recording(CH8_AUDIO_recorder *recorder)
+{
+    // converted in place, as samples are written in little endian byte order
+    uint8_t *bytes = (uint8_t *) recorder->buffer;
+    for (size_t i = 0; i < recorder->buffered; i++)
+        put_le(bytes + 2 * i, (uint16_t) recorder->buffer[i], 2);
+
+    if (fwrite(bytes, 2, recorder->buffered, recorder->out) != recorder->buffered)
+        recorder->error = 1;
+    recorder->buffered = 0;
+}
+
+
+//> Starts recording to out, which stays open after the recording has been stopped.
+//  Returns 0 on success.
+int
+CH8_AUDIO_record_start(CH8_AUDIO_recorder *recorder, FILE *out, int format,
+                       uint32_t sample_rate, uint32_t freq, int32_t amplitude)
+{
+    CH8_AUDIO_synth_init(&recorder->synth, sample_rate, freq, amplitude);
+    recorder->out      = out;
+    recorder->format   = format;
+    recorder->error    = 0;
+    recorder->frames   = 0;
+    recorder->samples  = 0;
+    recorder->buffered = 0;
+
+    // a stream of unknown length, until the sizes are patched
+    if (format == CH8_AUDIO_WAV && write_wav_header(out, sample_rate, UINT32_MAX) != 0)
+        recorder->error = 1;
+    return recorder->error ? -1 : 0;
+}
+
+
+//> Records the frame following the one the vm has just run, i.e. the sound output of
+//  the vm after its timers have been decremented, like it is played live. The samples
+//  of a second are spread evenly over its 60 frames. Returns 0 on success.
+int
+CH8_AUDIO_record_frame(CH8_AUDIO_recorder *recorder, const CH8_VM *vm)
+{
+    CH8_AUDIO_state state;
+    CH8_AUDIO_get_state(vm, &state);
+    CH8_AUDIO_set_state(&recorder->synth, &state);
+
+    uint64_t rate = recorder->synth.sample_rate;
+    uint64_t n_samples = (recorder->frames + 1) * rate / CH8_AUDIO_FRAME_RATE -
+                         recorder->frames * rate / CH8_AUDIO_FRAME_RATE;
+    recorder->frames++;
+    recorder->samples += n_samples;
+
+    while (n_samples > 0) {
+        size_t n = CH8_AUDIO_RECORD_BUFFER - recorder->buffered;
+        if (n > n_samples)
+            n = (size_t) n_samples;
+
+        CH8_AUDIO_render(&recorder->synth, recorder->buffer + recorder->buffered, n);
+        recorder->buffered += n;
+        n_samples -= n;
+
+        if (recorder->buffered == CH8_AUDIO_RECORD_BUFFER)
+            flush_recording(recorder);
+    }
+    return recorder->error ? -1 : 0;
+}
+
+
+//> Writes the samples still buffered and patches the sizes in the header of a WAV file
+//  if the output can seek. Returns 0 if the whole recording has been written.
+int
+CH8_AUDIO_record_stop(CH8_AUDIO_recorder *recorder)
+{
+    flush_recording(recorder);
+
+    if (recorder->format == CH8_AUDIO_WAV && fseek(recorder->out, 0L, SEEK_SET) == 0) {
+        if (write_wav_header(recorder->out, recorder->synth.sample_rate, recorder->samples) != 0)
+            recorder->error = 1;
+        fseek(recorder->out, 0L, SEEK_END);
+    }
+
+    if (fflush(recorder->out) != 0)
+        recorder->error = 1;
+    return recorder->error ? -1 : 0;
+}
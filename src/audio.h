@@ -0,0 +1,118 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_AUDIO_H
+#define CATASTROPHIC_CHIP8_AUDIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vm.h"
+
+
+#define CH8_AUDIO_PATTERN_BITS 128  // samples of an XO-CHIP audio pattern
+#define CH8_AUDIO_RECORD_BUFFER 8192 // samples a recorder buffers before writing them
+#define CH8_AUDIO_FRAME_RATE    60   // frames per second the timers are decremented at
+
+
+typedef enum {
+    CH8_AUDIO_WAV = 0, // 16-bit mono WAV file
+    CH8_AUDIO_RAW      // headerless signed 16-bit little endian samples
+} CH8_AUDIO_format;
+
+
+// Sound output of a vm: whether the sound timer runs and what it plays
+typedef struct CH8_AUDIO_state {
+    uint8_t pattern[16]; // XO-CHIP audio pattern, most significant bit first
+    uint8_t pitch;
+    uint8_t use_pattern; // F002 has been executed, otherwise the beep is played
+    uint8_t on;
+} CH8_AUDIO_state;
+
+
+// Generator of the sound of a vm. The beep is a square wave like the buzzer of the
+// original hardware. The phase is a fixed point fraction of a period that wraps around
+// at 2^32, so rendering a sample costs an addition and the wave continues seamlessly
+// from one buffer to the next. While the sound is off, silence is rendered.
+//
+// An XO-CHIP audio pattern is resampled from its rate to the sample rate: a period of
+// the phase covers the whole pattern, and each sample is the mean of the pattern over
+// the interval since the previous sample, computed from prefix sums of its bits. The
+// synth doesn't allocate, so it can run in audio callbacks.
+typedef struct CH8_AUDIO_synth {
+    uint32_t phase;       // position in the current period
+    uint32_t step;        // phase advance per sample of the beep
+    uint32_t sample_rate;
+    int16_t  amplitude;
+    uint8_t  on;          // sound on, see CH8_AUDIO_set_sound
+
+    uint8_t  use_pattern;
+    uint8_t  pattern[16];
+    uint8_t  pitch;
+    uint32_t pattern_step; // phase advance per sample of the pattern
+    int64_t  scale;        // amplitude * 2^32 / pattern_step
+    uint8_t  bits[CH8_AUDIO_PATTERN_BITS];
+    uint8_t  ones[CH8_AUDIO_PATTERN_BITS + 1]; // set bits before bit i
+} CH8_AUDIO_synth;
+
+
+// Records the sound of a vm in emulated time, e.g. to check it in automated runs
+// without an audio device. Every frame renders sample_rate / 60 samples into a
+// preallocated buffer, which is written out whenever it fills up, so recording takes as
+// long as rendering and writing the samples, however long the recording is. The output
+// may be a pipe: the sizes in the header of a WAV file are only patched when the
+// recording is closed if the output can seek, and left at their maximum otherwise.
+typedef struct CH8_AUDIO_recorder {
+    CH8_AUDIO_synth synth;
+    FILE    *out;
+    int      format;    // CH8_AUDIO_format
+    int      error;     // writing to out failed
+    uint64_t frames;    // frames recorded
+    uint64_t samples;   // samples recorded
+    size_t   buffered;  // samples in buffer
+    int16_t  buffer[CH8_AUDIO_RECORD_BUFFER];
+} CH8_AUDIO_recorder;
+
+
+void CH8_AUDIO_synth_init(CH8_AUDIO_synth *synth, uint32_t sample_rate, uint32_t freq,
+                          int32_t amplitude);
+
+void CH8_AUDIO_set_sound(CH8_AUDIO_synth *synth, int on);
+
+void CH8_AUDIO_get_state(const CH8_VM *vm, CH8_AUDIO_state *state);
+
+void CH8_AUDIO_set_state(CH8_AUDIO_synth *synth, const CH8_AUDIO_state *state);
+
+void CH8_AUDIO_render(CH8_AUDIO_synth *synth, int16_t *samples, size_t n_samples);
+
+int  CH8_AUDIO_record_start(CH8_AUDIO_recorder *recorder, FILE *out, int format,
+                            uint32_t sample_rate, uint32_t freq, int32_t amplitude);
+
+int  CH8_AUDIO_record_frame(CH8_AUDIO_recorder *recorder, const CH8_VM *vm);
+
+int  CH8_AUDIO_record_stop(CH8_AUDIO_recorder *recorder);
+
+#endif //CATASTROPHIC_CHIP8_AUDIO_H
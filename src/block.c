@@ -0,0 +1,254 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include "block.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "instructions.h"
+#include "jit.h"
+
+#include "../rf/mystdlib.h"
+
+
+//> Allocates an empty block cache. If compile_hot_blocks is set and the host supports
+//  it, blocks are compiled to native code once they are hot.
+CH8_BLOCK_cache *
+CH8_BLOCK_cache_create(int compile_hot_blocks)
+{
+    CH8_BLOCK_cache *cache = calloc(1, sizeof(CH8_BLOCK_cache)); NP_CHECK(cache)
+
+    if (compile_hot_blocks)
+        cache->jit = CH8_JIT_arena_create();
+    return cache;
+}
+
+
+void
+CH8_BLOCK_cache_destroy(CH8_BLOCK_cache *cache)
+{
+    if (cache == NULL)
+        return;
+    CH8_JIT_arena_destroy(cache->jit);
+    free(cache);
+}
+
+
+//> Drops all translated blocks and their native code.
+void
+CH8_BLOCK_flush(CH8_BLOCK_cache *cache)
+{
+    memset(cache->by_addr, 0x00, sizeof(cache->by_addr));
+    memset(cache->is_code, 0x00, sizeof(cache->is_code));
+    cache->n_blocks = 0;
+    cache->n_ops    = 0;
+    cache->generation++;
+
+    CH8_JIT_arena_reset(cache->jit);
+}
+
+
+//> Flags the vm if the memory range [addr, addr + len) overlaps any translated
+//  block. Blocks are then flushed before the next one is entered.
+void
+CH8_BLOCK_invalidate(CH8_VM *vm, uint16_t addr, uint16_t len)
+{
+    if (vm->blocks == NULL || len == 0 || addr >= CH8_VM_MEM_SIZE)
+        return;
+
+    uint32_t last = (uint32_t) addr + len - 1;
+    if (last >= CH8_VM_MEM_SIZE)
+        last = CH8_VM_MEM_SIZE - 1;
+
+    for (uint32_t i = addr >> 1u; i <= last >> 1u; i++)
+        if (vm->blocks->is_code[i]) {
+            vm->internal_flags |= CH8_VM_CODE_MODIFIED;
+            return;
+        }
+}
+
+
+//> Translates the block starting at addr into micro-ops.
+static CH8_BLOCK *
+translate(CH8_VM *vm, uint16_t addr)
+{
+    CH8_BLOCK_cache *cache = vm->blocks;
+
+    if (cache->n_blocks == CH8_BLOCK_MAX_BLOCKS ||
+        cache->n_ops + CH8_BLOCK_MAX_LEN > CH8_BLOCK_MAX_OPS)
+        CH8_BLOCK_flush(cache);
+
+    CH8_BLOCK *block = &cache->blocks[cache->n_blocks++];
+    CH8_INSTR_decoded *ops = &cache->ops[cache->n_ops];
+
+    block->start = addr;
+    block->n_ops = 0;
+    block->ops   = ops;
+    block->next[0] = block->next[1] = NULL;
+    block->next_pc[0] = block->next_pc[1] = 0;
+    block->native     = NULL;
+    block->n_native   = 0;
+    block->exec_count = 0;
+
+    // the block ends with the first instruction that may change the program counter
+    CH8_INSTR_decoded *op;
+    do {
+        op = &ops[block->n_ops++];
+        CH8_INSTR_decode(vm->mem[addr] << 8u | vm->mem[addr + 1], op);
+        cache->is_code[addr >> 1u] = 1;
+        addr += 2;
+    } while (!CH8_INSTR_ends_block(op) &&
+             block->n_ops < CH8_BLOCK_MAX_LEN &&
+             addr < CH8_VM_MEM_SIZE);
+
+    // the block is only entered at its start, so no jump can land between the two
+    // instructions of a superinstruction. Compiled blocks are left unfused, as the
+    // JIT only handles plain instructions.
+    int fuse = cache->jit == NULL && !(vm->opt_flags & CH8_VM_NO_FUSION);
+    for (uint16_t i = 0; i < block->n_ops; ) {
+        block->tail = i;
+        i += fuse && i + 1 < block->n_ops ? CH8_INSTR_fuse(&ops[i]) : 1;
+    }
+
+    cache->n_ops += block->n_ops;
+    cache->by_addr[block->start >> 1u] = block;
+    return block;
+}
+
+
+//> Returns the block starting at addr, translating it if needed.
+static CH8_BLOCK *
+lookup(CH8_VM *vm, uint16_t addr)
+{
+    CH8_BLOCK *block = vm->blocks->by_addr[addr >> 1u];
+    return block ? block : translate(vm, addr);
+}
+
+
+//> Returns the successor of a block starting at addr and chains the two blocks, so
+//  the successor is found without a lookup next time.
+static CH8_BLOCK *
+chain(CH8_VM *vm, CH8_BLOCK *block, uint16_t addr)
+{
+    if (block->next_pc[0] == addr && block->next[0])
+        return block->next[0];
+    if (block->next_pc[1] == addr && block->next[1])
+        return block->next[1];
+
+    uint32_t generation = vm->blocks->generation;
+    CH8_BLOCK *next = lookup(vm, addr);
+    if (generation != vm->blocks->generation)
+        return next; // translating the successor flushed the block itself
+
+    int slot = block->next[0] == NULL ? 0 : 1; // the second slot holds the latest
+                                               // successor of dynamic jumps
+    block->next[slot]    = next;
+    block->next_pc[slot] = addr;
+    return next;
+}
+
+
+//> Executes all micro-ops of a block.
+static inline void
+exec_block(CH8_VM *vm, const CH8_BLOCK *block)
+{
+    const CH8_INSTR_decoded *op   = block->ops + block->n_native;
+    const CH8_INSTR_decoded *tail = block->ops + block->tail;
+
+    if (block->native)
+        block->native(&vm->cpu);
+
+    // only the last instruction depends on the program counter
+    for (; op < tail; op += op->len)
+        op->handler(vm, op);
+
+    vm->cpu.pc = block->start + (block->tail << 1u);
+    vm->current_opcode = tail->opcode;
+    tail->handler(vm, tail);
+    vm->cpu.pc += 2;
+
+    vm->cycles += block->n_ops;
+}
+
+
+//> Runs the vm for n_cycles instructions by executing translated blocks. A block that
+//  doesn't fit into the rest of the budget is executed instruction by instruction up
+//  to its end, so every engine runs the same instructions per frame. Returns early
+//  once the rom waits in an idle loop.
+int
+CH8_BLOCK_run(CH8_VM *vm, uint64_t n_cycles)
+{
+    if (vm->blocks == NULL)
+        vm->blocks = CH8_BLOCK_cache_create(vm->opt_flags & CH8_VM_JIT_ENGINE);
+
+    uint64_t end = vm->cycles + n_cycles;
+    CH8_BLOCK *block = NULL;
+
+    vm->internal_flags &= ~CH8_VM_IDLE;
+
+    while (vm->cycles < end)
+    {
+        // translated code has been overwritten, by the rom or by the host loading
+        // another one
+        if (vm->internal_flags & CH8_VM_CODE_MODIFIED) {
+            CH8_BLOCK_flush(vm->blocks);
+            vm->internal_flags &= ~CH8_VM_CODE_MODIFIED;
+            block = NULL;
+        }
+
+        // blocks start at even addresses only, everything else is interpreted
+        if (vm->cpu.pc & (0xF000u | 0x0001u)) {
+            int rc = CH8_VM_emulate_cycle(vm);
+            if (rc != CH8_VM_SUCCESS || (vm->internal_flags & CH8_VM_IDLE))
+                return rc;
+            block = NULL;
+            continue;
+        }
+
+        block = block ? chain(vm, block, vm->cpu.pc) : lookup(vm, vm->cpu.pc);
+
+        // the rest of the budget ends before the block does, and only its last
+        // instruction may leave it
+        if (block->n_ops > end - vm->cycles) {
+            while (vm->cycles < end) {
+                int rc = CH8_VM_emulate_cycle(vm);
+                if (rc != CH8_VM_SUCCESS || (vm->internal_flags & CH8_VM_IDLE))
+                    return rc;
+            }
+            break;
+        }
+
+        exec_block(vm, block);
+
+        if (++block->exec_count == CH8_JIT_HOT_THRESHOLD && vm->blocks->jit)
+            CH8_JIT_compile(vm->blocks->jit, block);
+
+        if (vm->internal_flags & (CH8_VM_FAULT | CH8_VM_IDLE))
+            return vm->internal_flags & CH8_VM_FAULT ? CH8_VM_UNSUPPORTED_OPCODE : CH8_VM_SUCCESS;
+    }
+    return CH8_VM_SUCCESS;
+}
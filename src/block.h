@@ -0,0 +1,90 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_BLOCK_H
+#define CATASTROPHIC_CHIP8_BLOCK_H
+
+#include "vm.h"
+
+struct CH8_JIT_arena;
+
+
+typedef enum {
+    CH8_BLOCK_MAX_LEN    = 64,   // max number of instructions in a block
+    CH8_BLOCK_MAX_BLOCKS = 2048, // max number of blocks translated at once
+    CH8_BLOCK_MAX_OPS    = 8192  // max number of micro-ops of all translated blocks
+} CH8_BLOCK_limits;
+
+
+// A straight-line run of instructions that is entered at its first instruction and
+// left after its last one. Only the last instruction may change the program counter.
+typedef struct CH8_BLOCK {
+    uint16_t start; // address of the first instruction
+    uint16_t n_ops; // number of instructions, including the one ending the block
+
+    // Micro-ops, one per instruction. A superinstruction takes the place of the first
+    // instruction it executes and is followed by the op of the second.
+    const CH8_INSTR_decoded *ops;
+    uint16_t tail; // index of the op executing the last instruction
+
+    // Successors the block has been chained to. Taken and not taken branches of
+    // skips can both be chained.
+    struct CH8_BLOCK *next[2];
+    uint16_t          next_pc[2];
+
+    // Native code executing the first n_native micro-ops (see jit.h)
+    void   (*native)(CH8_CPU *cpu);
+    uint16_t n_native;
+    uint32_t exec_count;
+} CH8_BLOCK;
+
+
+typedef struct CH8_BLOCK_cache {
+    CH8_BLOCK *by_addr[CH8_VM_MEM_SIZE / 2]; // blocks by (even) start address
+    uint8_t    is_code[CH8_VM_MEM_SIZE / 2]; // whether an address has been translated
+
+    CH8_BLOCK         blocks[CH8_BLOCK_MAX_BLOCKS];
+    CH8_INSTR_decoded ops[CH8_BLOCK_MAX_OPS];
+
+    size_t n_blocks;
+    size_t n_ops;
+
+    uint32_t generation; // incremented whenever the blocks are flushed
+
+    struct CH8_JIT_arena *jit; // native code of hot blocks, NULL if not compiling
+} CH8_BLOCK_cache;
+
+
+CH8_BLOCK_cache *CH8_BLOCK_cache_create(int compile_hot_blocks);
+
+void CH8_BLOCK_cache_destroy(CH8_BLOCK_cache *cache);
+
+void CH8_BLOCK_flush(CH8_BLOCK_cache *cache);
+
+void CH8_BLOCK_invalidate(CH8_VM *vm, uint16_t addr, uint16_t len);
+
+int  CH8_BLOCK_run(CH8_VM *vm, uint64_t n_cycles);
+
+#endif //CATASTROPHIC_CHIP8_BLOCK_H
@@ -51,20 +51,20 @@ CH8_VM_DBG_output_cpu_dump(const char *callee, CH8_VM *vm, const char *fmt, ...)
 {
     fprintf(stderr, KRED"%s(): "KNRM"%s", callee, fmt);
     fprintf(stderr,"    op: 0x%04X pc: 0x%03X sp: 0x%02X I: 0x%03X\n",
-            vm->current_opcode, vm->cpu->pc, vm->cpu->sp, vm->cpu->I);
+            vm->current_opcode, vm->cpu.pc, vm->cpu.sp, vm->cpu.I);
 
     fprintf(stderr, "    registers: ");
     for (uint8_t i=0; i < 16; i++) {
-        fprintf(stderr,"0x%02X ", vm->cpu->V[i]);
+        fprintf(stderr,"0x%02X ", vm->cpu.V[i]);
     }
 
     fprintf(stderr,"\n");
     fprintf(stderr,"    stack:    ");
-    if (vm->cpu->sp == 0) {
+    if (vm->cpu.sp == 0) {
         fprintf(stderr,"empty");
     } else {
-        for (uint8_t i=0; i < 16 && i < vm->cpu->sp; i++) {
-            fprintf(stderr,"0x%03X ", vm->cpu->stack[i]);
+        for (uint8_t i=0; i < 16 && i < vm->cpu.sp; i++) {
+            fprintf(stderr,"0x%03X ", vm->cpu.stack[i]);
         }
     }
     fprintf(stderr,"\n");
@@ -0,0 +1,165 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include "gym.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../rf/mystdlib.h"
+
+
+#define CH8_GYM_FRAME_RATE 60 // frames per second, at which timers are decremented
+
+
+//> Creates an environment running a rom of size bytes at clock_freq instructions per
+//  second with the engine selected by opt_flags. Returns NULL if the rom is too large.
+CH8_GYM_env *
+CH8_GYM_create(const uint8_t *rom, size_t size, uint32_t clock_freq, uint32_t opt_flags)
+{
+    if (size > CH8_VM_MAX_PROGSIZE)
+        return NULL;
+
+    CH8_GYM_env *env = calloc(1, sizeof(CH8_GYM_env)); NP_CHECK(env)
+
+    memcpy(env->rom, rom, size);
+    env->rom_size  = size;
+    env->opt_flags = opt_flags;
+
+    env->cycles_per_frame = clock_freq / CH8_GYM_FRAME_RATE;
+    if (env->cycles_per_frame == 0)
+        env->cycles_per_frame = 1;
+
+    env->vm = CH8_VM_init(opt_flags);
+    CH8_GYM_reset(env, 0);
+    return env;
+}
+
+
+void
+CH8_GYM_destroy(CH8_GYM_env *env)
+{
+    if (env == NULL)
+        return;
+    CH8_VM_kill(env->vm);
+    free(env);
+}
+
+
+//> Sets the hook computing the reward after every frame. Without a hook, every frame
+//  is rewarded with 0.
+void
+CH8_GYM_set_reward_hook(CH8_GYM_env *env, CH8_GYM_reward_hook hook, void *user)
+{
+    env->reward      = hook;
+    env->reward_user = user;
+}
+
+
+//> Ends episodes after max_frames frames, or never if max_frames is 0.
+void
+CH8_GYM_set_max_frames(CH8_GYM_env *env, uint64_t max_frames)
+{
+    env->max_frames = max_frames;
+}
+
+
+//> Makes reset and step copy observations into a buffer of CH8_GYM_OBS_WORDS words
+//  owned by the caller and return it. With NULL, they return the display of the vm
+//  itself, which is only valid until the next step.
+void
+CH8_GYM_set_observation_buffer(CH8_GYM_env *env, uint64_t *buffer)
+{
+    env->observation = buffer;
+}
+
+
+//> Returns the vm of an environment, e.g. for reading the memory of the rom.
+CH8_VM *
+CH8_GYM_get_vm(CH8_GYM_env *env)
+{
+    return env->vm;
+}
+
+
+static const uint64_t *
+observe(CH8_GYM_env *env)
+{
+    if (env->observation == NULL)
+        return CH8_VM_get_display(env->vm);
+
+    memcpy(env->observation, CH8_VM_get_display(env->vm), CH8_GYM_OBS_SIZE);
+    return env->observation;
+}
+
+
+//> Starts a new episode by loading the rom into a reset vm. The seed selects the random
+//  numbers instruction Cxkk draws. Returns the first observation.
+const uint64_t *
+CH8_GYM_reset(CH8_GYM_env *env, uint64_t seed)
+{
+    CH8_VM_reset(env->vm, env->opt_flags);
+    CH8_VM_load_rom_buffer(env->vm, env->rom, env->rom_size);
+    CH8_VM_seed(env->vm, seed);
+
+    env->frames = 0;
+    env->done   = 0;
+    return observe(env);
+}
+
+
+//> Holds the keys set in action_mask, bit k for key k, for the given number of frames
+//  and returns the observation after them. The rewards of the frames are summed up in
+//  *reward. *done is set once the episode is over: the reward hook ended it, the frame
+//  limit has been reached or the rom executed an unsupported opcode. Steps of an
+//  episode that is over don't run any frames. reward and done may be NULL.
+const uint64_t *
+CH8_GYM_step(CH8_GYM_env *env, uint16_t action_mask, uint32_t frames,
+             double *reward, int *done)
+{
+    double sum = 0.0;
+
+    for (uint8_t key = 0; key < 16; key++)
+        CH8_VM_set_key(env->vm, key, (action_mask >> key) & 1u);
+
+    for (uint32_t i = 0; i < frames && !env->done; i++)
+    {
+        if (CH8_VM_run_frame(env->vm, env->cycles_per_frame) != CH8_VM_SUCCESS)
+            env->done = 1;
+        env->frames++;
+
+        if (env->reward)
+            sum += env->reward(env->vm, &env->done, env->reward_user);
+        if (env->max_frames > 0 && env->frames >= env->max_frames)
+            env->done = 1;
+    }
+
+    if (reward)
+        *reward = sum;
+    if (done)
+        *done = env->done;
+    return observe(env);
+}
@@ -0,0 +1,88 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_GYM_H
+#define CATASTROPHIC_CHIP8_GYM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+
+// Observations are the packed display: one 64-bit word per row, the most significant
+// bit being the leftmost pixel (see CH8_VM.display).
+#define CH8_GYM_OBS_WORDS CH8_VM_SCR_H
+#define CH8_GYM_OBS_SIZE  (CH8_GYM_OBS_WORDS * sizeof(uint64_t))
+
+
+// Computes the reward of the frame just run from the state of the vm, e.g. from the
+// score the rom keeps in memory. May end the episode by setting *done.
+typedef double (*CH8_GYM_reward_hook)(const CH8_VM *vm, int *done, void *user);
+
+
+// A rom run frame by frame for agents: each step presses the keys of an action and
+// runs a number of frames, then reports the display, the reward and whether the
+// episode is done. Steps don't allocate, and observations are returned as a pointer
+// to the display of the vm or to a buffer provided by the caller, so bindings like
+// ctypes can poll them without copies.
+typedef struct CH8_GYM_env {
+    CH8_VM  *vm;
+    uint32_t opt_flags;
+
+    uint8_t  rom[CH8_VM_MAX_PROGSIZE]; // loaded again on every reset
+    size_t   rom_size;
+
+    uint64_t cycles_per_frame;         // cpu frequency / 60
+    uint64_t max_frames;               // frames after which an episode is done, 0 for no limit
+
+    CH8_GYM_reward_hook reward;
+    void               *reward_user;
+
+    uint64_t *observation;             // caller buffer of CH8_GYM_OBS_WORDS words, or NULL
+
+    uint64_t frames;                   // frames run in the episode
+    int      done;
+} CH8_GYM_env;
+
+
+CH8_GYM_env    *CH8_GYM_create(const uint8_t *rom, size_t size, uint32_t clock_freq, uint32_t opt_flags);
+
+void            CH8_GYM_destroy(CH8_GYM_env *env);
+
+void            CH8_GYM_set_reward_hook(CH8_GYM_env *env, CH8_GYM_reward_hook hook, void *user);
+
+void            CH8_GYM_set_max_frames(CH8_GYM_env *env, uint64_t max_frames);
+
+void            CH8_GYM_set_observation_buffer(CH8_GYM_env *env, uint64_t *buffer);
+
+CH8_VM         *CH8_GYM_get_vm(CH8_GYM_env *env);
+
+const uint64_t *CH8_GYM_reset(CH8_GYM_env *env, uint64_t seed);
+
+const uint64_t *CH8_GYM_step(CH8_GYM_env *env, uint16_t action_mask, uint32_t frames,
+                             double *reward, int *done);
+
+#endif //CATASTROPHIC_CHIP8_GYM_H
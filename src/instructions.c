@@ -27,11 +27,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "debug.h"
 
-#define HIGH_PIXEL 0xFFFFFFFF
-
 /*** Some naïve macros to hopefully increase code readability *****************/
 
 
@@ -41,7 +40,7 @@
 #define KK(opcode)  ( (opcode) & 0x00FFu )
 #define NNN(opcode) ( (opcode) & 0x0FFFu )
 
-#define CPU(vm_ptr) ((vm_ptr)->cpu) // Using this macro its just more clear
+#define CPU(vm_ptr) (&(vm_ptr)->cpu) // Using this macro its just more clear
                                     // that we are manipulating the CPU of our
                                     // vm. Accessing all those nested sub-objects
                                     // with arrow operators is quite annoying to read.
@@ -51,33 +50,72 @@
 
 //> Execute machine language subroutine at address nnn.
 void 
-CH8_INSTR_0nnn(CH8_VM *vm) // instruction ignored by most chip8 emulators
-{}
+CH8_INSTR_0nnn(CH8_VM *vm, const CH8_INSTR_decoded *op) // instruction ignored by most chip8 emulators
+{
+    (void) vm;
+    (void) op;
+}
 
 
 //> Clear the screen.
 void 
-CH8_INSTR_00E0(CH8_VM *vm)
+CH8_INSTR_00E0(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    memset(vm->framebuffer, 0x00, sizeof(vm->framebuffer));
+    (void) op;
+
+    for (int row = 0; row < CH8_VM_SCR_H; row++)
+        if (vm->display[row])
+            vm->dirty_rows |= 1u << row;
+
+    memset(vm->display, 0x00, sizeof(vm->display));
     vm->internal_flags |= CH8_VM_SCREEN_UPDATE;
 }
 
 
 //> Return from a subroutine.
 void 
-CH8_INSTR_00EE(CH8_VM *vm)
+CH8_INSTR_00EE(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    CPU(vm)->sp--;
+    (void) op;
+
+    CPU(vm)->sp = (CPU(vm)->sp - 1u) & 0x0Fu;
     CPU(vm)->pc = CPU(vm)->stack[CPU(vm)->sp];
 }
 
 
+//> Flags the vm as idle if a jump from the program counter back to target closes a
+//  loop that can't be left before the next timer tick: a jump to itself, or a loop
+//  polling the delay timer with Fx07, 3x00 while the timer is still running.
+static void
+check_idle_loop(CH8_VM *vm, uint16_t target)
+{
+    uint16_t pc = CPU(vm)->pc;
+
+    if (target == pc) {
+        vm->internal_flags |= CH8_VM_IDLE;
+        return;
+    }
+    if (target + 4 != pc || CPU(vm)->delay_timer == 0)
+        return;
+
+    uint8_t loop[4]; // the loop may wrap around the end of memory
+    for (uint16_t i = 0; i < 4; i++)
+        loop[i] = vm->mem[(target + i) & 0x0FFFu];
+
+    if ((loop[0] & 0xF0u) == 0xF0 && loop[1] == 0x07 &&             // Fx07
+        loop[2] == (0x30u | (loop[0] & 0x0Fu)) && loop[3] == 0x00)  // 3x00
+        vm->internal_flags |= CH8_VM_IDLE;
+}
+
+
 //> Jump to address nnn.
 void 
-CH8_INSTR_1nnn(CH8_VM *vm)
+CH8_INSTR_1nnn(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint16_t nnn = NNN(vm->current_opcode);
+    uint16_t nnn = op->nnn;
+
+    if (nnn <= CPU(vm)->pc) // only backward jumps close loops
+        check_idle_loop(vm, nnn);
 
     CPU(vm)->pc = nnn - 2; // we don't want to increment our stack pointer when
                            // jumping to an address
@@ -86,12 +124,13 @@ CH8_INSTR_1nnn(CH8_VM *vm)
 
 //> Execute subroutine starting at address nnn.
 void
-CH8_INSTR_2nnn(CH8_VM *vm)
+CH8_INSTR_2nnn(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint16_t nnn = (vm->current_opcode & 0x0FFFu);
+    uint16_t nnn = op->nnn;
 
-    CPU(vm)->stack[CPU(vm)->sp] = CPU(vm)->pc;
-    CPU(vm)->sp++;
+    // the stack wraps around instead of overflowing into the rest of the vm
+    CPU(vm)->stack[CPU(vm)->sp & 0x0Fu] = CPU(vm)->pc;
+    CPU(vm)->sp = (CPU(vm)->sp + 1u) & 0x0Fu;
     CPU(vm)->pc = nnn - 2; // we don't want to increment our stack pointer when
                            // jumping to a subroutine
 }
@@ -99,10 +138,10 @@ CH8_INSTR_2nnn(CH8_VM *vm)
 
 //> Skip the following instruction if the value of register Vx equals kk.
 void 
-CH8_INSTR_3xkk(CH8_VM *vm)
+CH8_INSTR_3xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x  = X(vm->current_opcode);
-    uint8_t kk = KK(vm->current_opcode);
+    uint8_t x  = op->x;
+    uint8_t kk = op->kk;
 
     if (CPU(vm)->V[x] == kk)
         CPU(vm)->pc += 2;
@@ -111,10 +150,10 @@ CH8_INSTR_3xkk(CH8_VM *vm)
 
 //> Skip the following instruction if the value of register Vx is not equal to kk.
 void 
-CH8_INSTR_4xkk(CH8_VM *vm)
+CH8_INSTR_4xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x  = X(vm->current_opcode);
-    uint8_t kk = KK(vm->current_opcode);
+    uint8_t x  = op->x;
+    uint8_t kk = op->kk;
 
     if (CPU(vm)->V[x] != kk)
         CPU(vm)->pc += 2;
@@ -124,10 +163,10 @@ CH8_INSTR_4xkk(CH8_VM *vm)
 //> Skip the following instruction if the value of register Vx is equal to the value
 //  of register VY.
 void 
-CH8_INSTR_5xy0(CH8_VM *vm)
+CH8_INSTR_5xy0(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     if (CPU(vm)->V[x] == CPU(vm)->V[y])
         CPU(vm)->pc += 2;
@@ -136,10 +175,10 @@ CH8_INSTR_5xy0(CH8_VM *vm)
 
 //> Store number kk in register Vx.
 void
-CH8_INSTR_6xkk(CH8_VM *vm)
+CH8_INSTR_6xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x  = X(vm->current_opcode);
-    uint8_t kk = KK(vm->current_opcode);
+    uint8_t x  = op->x;
+    uint8_t kk = op->kk;
 
     CPU(vm)->V[x] = kk;
 }
@@ -147,10 +186,10 @@ CH8_INSTR_6xkk(CH8_VM *vm)
 
 //> Add the value kk to register Vx.
 void 
-CH8_INSTR_7xkk(CH8_VM *vm)
+CH8_INSTR_7xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x  = X(vm->current_opcode);
-    uint8_t kk = KK(vm->current_opcode);
+    uint8_t x  = op->x;
+    uint8_t kk = op->kk;
 
     CPU(vm)->V[x] += kk;
 }
@@ -158,10 +197,10 @@ CH8_INSTR_7xkk(CH8_VM *vm)
 
 //> Store the value of register Vy in register Vx.
 void 
-CH8_INSTR_8xy0(CH8_VM *vm)
+CH8_INSTR_8xy0(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     CPU(vm)->V[x] = CPU(vm)->V[y];
 }
@@ -169,10 +208,10 @@ CH8_INSTR_8xy0(CH8_VM *vm)
 
 //> Set Vx to Vx OR Vy.
 void 
-CH8_INSTR_8xy1(CH8_VM *vm)
+CH8_INSTR_8xy1(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     CPU(vm)->V[x] |= CPU(vm)->V[y];
 }
@@ -180,10 +219,10 @@ CH8_INSTR_8xy1(CH8_VM *vm)
 
 //> Set Vx to Vx AND Vy.
 void 
-CH8_INSTR_8xy2(CH8_VM *vm)
+CH8_INSTR_8xy2(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     CPU(vm)->V[x] &= CPU(vm)->V[y];
 }
@@ -191,10 +230,10 @@ CH8_INSTR_8xy2(CH8_VM *vm)
 
 //> Set Vx to Vx xOR Vy.
 void 
-CH8_INSTR_8xy3(CH8_VM *vm)
+CH8_INSTR_8xy3(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     CPU(vm)->V[x] ^= CPU(vm)->V[y];
 }
@@ -204,10 +243,10 @@ CH8_INSTR_8xy3(CH8_VM *vm)
 //> Set VF to 01 if a carry occurs.
 //> Set VF to 00 if a carry does not occur.
 void 
-CH8_INSTR_8xy4(CH8_VM *vm)
+CH8_INSTR_8xy4(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     uint16_t r = CPU(vm)->V[x] + CPU(vm)->V[y];
     if (r > 0xFFu)
@@ -223,10 +262,10 @@ CH8_INSTR_8xy4(CH8_VM *vm)
 //> Set VF to 00 if a borrow occurs
 //> Set VF to 01 if a borrow does not occur.
 void 
-CH8_INSTR_8xy5(CH8_VM *vm)
+CH8_INSTR_8xy5(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     if (CPU(vm)->V[x] >= CPU(vm)->V[y])
         CPU(vm)->V[0xF] = 0x01u;
@@ -241,9 +280,9 @@ CH8_INSTR_8xy5(CH8_VM *vm)
 //> Set register VF to the least significant bit prior to the shift.
 //> Vy is unchanged.
 void 
-CH8_INSTR_8xy6(CH8_VM *vm)
+CH8_INSTR_8xy6(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     CPU(vm)->V[0xF] = (CPU(vm)->V[x] & 0x01u);
     CPU(vm)->V[x] >>= 0x01u;
@@ -254,10 +293,10 @@ CH8_INSTR_8xy6(CH8_VM *vm)
 //> Set VF to 00 if a borrow occurs.
 //> Set VF to 01 if a borrow does not occur.
 void 
-CH8_INSTR_8xy7(CH8_VM *vm)
+CH8_INSTR_8xy7(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     if (CPU(vm)->V[y] >= CPU(vm)->V[x])
         CPU(vm)->V[0xF] = 0x01u;
@@ -272,9 +311,9 @@ CH8_INSTR_8xy7(CH8_VM *vm)
 //> Set register VF to the most significant bit prior to the shift.
 //> Vy is unchanged.
 void 
-CH8_INSTR_8xyE(CH8_VM *vm)
+CH8_INSTR_8xyE(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     CPU(vm)->V[0xF] = (CPU(vm)->V[x] & 0x80u) >> 7u;
     CPU(vm)->V[x] <<= 1u;
@@ -284,10 +323,10 @@ CH8_INSTR_8xyE(CH8_VM *vm)
 //> Skip the following instruction if the value of register Vx is not equal to the
 //> value of register Vy.
 void 
-CH8_INSTR_9xy0(CH8_VM *vm)
+CH8_INSTR_9xy0(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
 
     if (CPU(vm)->V[x] != CPU(vm)->V[y])
         CPU(vm)->pc += 2;
@@ -296,9 +335,9 @@ CH8_INSTR_9xy0(CH8_VM *vm)
 
 //> Store memory address nnn in register I.
 void
-CH8_INSTR_Annn(CH8_VM *vm)
+CH8_INSTR_Annn(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint16_t nnn = NNN(vm->current_opcode);
+    uint16_t nnn = op->nnn;
 
     CPU(vm)->I = nnn;
 }
@@ -306,9 +345,9 @@ CH8_INSTR_Annn(CH8_VM *vm)
 
 //> Jump to address nnn + V0.
 void 
-CH8_INSTR_Bnnn(CH8_VM *vm)
+CH8_INSTR_Bnnn(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint16_t nnn = NNN(vm->current_opcode);
+    uint16_t nnn = op->nnn;
 
     CPU(vm)->pc = nnn + CPU(vm)->V[0];
 }
@@ -316,12 +355,12 @@ CH8_INSTR_Bnnn(CH8_VM *vm)
 
 //> Set Vx to a random number with a mask of kk.
 void
-CH8_INSTR_Cxkk(CH8_VM *vm)
+CH8_INSTR_Cxkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x  = X(vm->current_opcode);
-    uint8_t kk = KK(vm->current_opcode);
+    uint8_t x  = op->x;
+    uint8_t kk = op->kk;
 
-    CPU(vm)->V[x] = (uint8_t)(rand() % 0xFFu + 1u) & kk;
+    CPU(vm)->V[x] = (uint8_t)(CH8_VM_random(vm) % 0xFFu + 1u) & kk;
 }
 
 
@@ -329,45 +368,50 @@ CH8_INSTR_Cxkk(CH8_VM *vm)
 //  address stored in I.
 //> Set VF to 01 if any set pixels are changed to unset, and 00 otherwise.
 void 
-CH8_INSTR_Dxyn(CH8_VM *vm)
+CH8_INSTR_Dxyn(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
-    uint8_t y = Y(vm->current_opcode);
-    uint8_t n = N(vm->current_opcode);
+    uint8_t x = op->x;
+    uint8_t y = op->y;
+    uint8_t n = op->n;
 
-    uint8_t x_coord = CPU(vm)->V[x];
-    uint8_t y_coord = CPU(vm)->V[y];
+    // pixels are addressed linearly modulo 2048, so a sprite crossing the right edge
+    // continues at the left edge of the next row
+    unsigned pos = (CPU(vm)->V[x] + (CPU(vm)->V[y] << 6u)) % (CH8_VM_SCR_W * CH8_VM_SCR_H);
+    unsigned row = pos >> 6u;
+    unsigned col = pos & 63u;
 
-    CPU(vm)->V[0xF] = 0x00u;
-    vm->internal_flags |= CH8_VM_SCREEN_UPDATE; // we are changing the framebuffer, so it has to be redrawn
+    vm->internal_flags |= CH8_VM_SCREEN_UPDATE; // we are changing the display, so it has to be redrawn
 
-    uint8_t sprite_byte;
-    for (unsigned short y_line = 0; y_line < n; y_line++)
+    uint64_t collision = 0;
+    for (unsigned line = 0; line < n; line++, row = (row + 1) & 31u)
     {
-        sprite_byte = vm->mem[CPU(vm)->I + y_line];
-
-        for (unsigned short x_line = 0; x_line < 8; x_line++)
-        {
-            if ((sprite_byte & (0x80 >> x_line))) // get each individual bit
-            {
-                uint16_t pixel = ((x_coord + x_line) + ((y_coord + y_line) << 6)) % 2048;
-                if (vm->framebuffer[pixel] == HIGH_PIXEL)
-                    CPU(vm)->V[0xF] = 0x01u;
-                vm->framebuffer[pixel] ^= HIGH_PIXEL;
-            }
+        uint64_t sprite = vm->mem[(CPU(vm)->I + line) & 0xFFFu];
+
+        uint64_t bits = sprite << 56u >> col;
+        collision        |= vm->display[row] & bits;
+        vm->display[row] ^= bits;
+        vm->dirty_rows   |= (uint32_t)(bits != 0) << row;
+
+        if (col > 56) {
+            unsigned next = (row + 1) & 31u;
+            uint64_t spill = sprite << (120u - col);
+            collision         |= vm->display[next] & spill;
+            vm->display[next] ^= spill;
+            vm->dirty_rows    |= (uint32_t)(spill != 0) << next;
         }
     }
+    CPU(vm)->V[0xF] = collision ? 0x01u : 0x00u;
 }
 
 
 //> Skip the following instruction if the key corresponding to the hex value
 //  currently stored in register Vx is pressed.
 void 
-CH8_INSTR_Ex9E(CH8_VM *vm)
+CH8_INSTR_Ex9E(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
-    if (vm->keypad[CPU(vm)->V[x]])
+    if (vm->keypad[CPU(vm)->V[x] & 0x0Fu])
         CPU(vm)->pc += 2;
 }
 
@@ -375,20 +419,20 @@ CH8_INSTR_Ex9E(CH8_VM *vm)
 //> Skip the following instruction if the key corresponding to the hex value
 //  currently stored in register Vx is not pressed.
 void 
-CH8_INSTR_ExA1(CH8_VM *vm)
+CH8_INSTR_ExA1(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
     
-    if (!vm->keypad[CPU(vm)->V[x]])
+    if (!vm->keypad[CPU(vm)->V[x] & 0x0Fu])
         CPU(vm)->pc += 2;
 }
 
 
 //> Store the current value of the delay timer in register Vx.
 void 
-CH8_INSTR_Fx07(CH8_VM *vm)
+CH8_INSTR_Fx07(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     CPU(vm)->V[x] = CPU(vm)->delay_timer;
 }
@@ -396,9 +440,9 @@ CH8_INSTR_Fx07(CH8_VM *vm)
 
 //> Wait for a keypress and store the result in register Vx.
 void 
-CH8_INSTR_Fx0A(CH8_VM *vm)
+CH8_INSTR_Fx0A(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     int any_key_pressed = 0;
     for (uint16_t i = 0; i < (uint16_t) sizeof(vm->keypad); i++)
@@ -408,16 +452,20 @@ CH8_INSTR_Fx0A(CH8_VM *vm)
             break;
         }
 
-    if (!any_key_pressed)
+    // Wait at this instruction, which is executed again once a key is pressed. Until
+    // then, the vm executes nothing (see CH8_VM_is_waiting_for_key).
+    if (!any_key_pressed) {
         CPU(vm)->pc -= 2;
+        vm->internal_flags |= CH8_VM_IDLE | CH8_VM_WAIT_KEY;
+    }
 }
 
 
 //> Set the delay timer to the value of register Vx.
 void 
-CH8_INSTR_Fx15(CH8_VM *vm)
+CH8_INSTR_Fx15(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     CPU(vm)->delay_timer = CPU(vm)->V[x];
 }
@@ -425,9 +473,9 @@ CH8_INSTR_Fx15(CH8_VM *vm)
 
 //> Set the sound timer to the value of register Vx.
 void 
-CH8_INSTR_Fx18(CH8_VM *vm)
+CH8_INSTR_Fx18(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     CPU(vm)->sound_timer = CPU(vm)->V[x];
 }
@@ -437,9 +485,9 @@ CH8_INSTR_Fx18(CH8_VM *vm)
 //> VF is set to 1 when ther is a range overflow (I+Vx > 0xFFF), and 0 when there
 //  isn't.
 void 
-CH8_INSTR_Fx1E(CH8_VM *vm)
+CH8_INSTR_Fx1E(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     if (CPU(vm)->I + CPU(vm)->V[x] > 0x0FFF)
         CPU(vm)->V[0xF] = 1u;
@@ -453,9 +501,9 @@ CH8_INSTR_Fx1E(CH8_VM *vm)
 //> Set I to the memory address of the sprite data corresponding to the hexadecimal
 //  digit stored in register Vx.
 void 
-CH8_INSTR_Fx29(CH8_VM *vm)
+CH8_INSTR_Fx29(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     CPU(vm)->I = CH8_VM_FONTSET_START_ADDR + CPU(vm)->V[x] * 5;
 }
@@ -464,29 +512,33 @@ CH8_INSTR_Fx29(CH8_VM *vm)
 //> Store the binary-coded decimal equivalent of the value stored in register Vx at
 //  addresses I, I + 1, and I + 2.
 void 
-CH8_INSTR_Fx33(CH8_VM *vm)
+CH8_INSTR_Fx33(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     uint8_t bcd100 =  CPU(vm)->V[x] / 100;
     uint8_t bcd10  = (CPU(vm)->V[x] / 10 ) % 10;
     uint8_t bcd1   =  CPU(vm)->V[x] % 10;
 
-    vm->mem[CPU(vm)->I]     = bcd100;
-    vm->mem[CPU(vm)->I + 1] = bcd10;
-    vm->mem[CPU(vm)->I + 2] = bcd1;
+    vm->mem[ CPU(vm)->I      & 0x0FFFu] = bcd100;
+    vm->mem[(CPU(vm)->I + 1) & 0x0FFFu] = bcd10;
+    vm->mem[(CPU(vm)->I + 2) & 0x0FFFu] = bcd1;
+
+    CH8_VM_invalidate(vm, CPU(vm)->I, 3); // the rom may have overwritten its own code
 }
 
 
 //> Store the values of registers V0 to Vx inclusive in memory starting at address I.
 //> I is set to I + x + 1 after operation.
 void 
-CH8_INSTR_Fx55(CH8_VM *vm)
+CH8_INSTR_Fx55(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     for (short i = 0; i <= x; i++)
-        vm->mem[CPU(vm)->I + i] = CPU(vm)->V[i];
+        vm->mem[(CPU(vm)->I + i) & 0x0FFFu] = CPU(vm)->V[i];
+
+    CH8_VM_invalidate(vm, CPU(vm)->I, x + 1); // the rom may have overwritten its own code
 
     if (vm->opt_flags & CH8_VM_ORIGINAL_IMPL) // Cowgod's Technical reference apparently
         CPU(vm)->I += x + 1;                  // describes opcodes 8xy6, 8xye, Fx55,
@@ -503,12 +555,12 @@ CH8_INSTR_Fx55(CH8_VM *vm)
 //  address I.
 //> I is set to I + x + 1 after operation
 void 
-CH8_INSTR_Fx65(CH8_VM *vm)
+CH8_INSTR_Fx65(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    uint8_t x = X(vm->current_opcode);
+    uint8_t x = op->x;
 
     for (short i = 0; i <= x; i++)
-        CPU(vm)->V[i] = vm->mem[CPU(vm)->I + i];
+        CPU(vm)->V[i] = vm->mem[(CPU(vm)->I + i) & 0x0FFFu];
 
     if (vm->opt_flags & CH8_VM_ORIGINAL_IMPL) // Cowgod's Technical reference apparently
         CPU(vm)->I += x + 1;                  // describes opcodes 8xy6, 8xye, Fx55,
@@ -521,28 +573,127 @@ CH8_INSTR_Fx65(CH8_VM *vm)
 }
 
 
+//> XO-CHIP: load the 16 bytes starting at address I into the audio pattern, which is
+//  played instead of the beep from now on.
+void
+CH8_INSTR_F002(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    (void) op;
+
+    for (uint16_t i = 0; i < (uint16_t) sizeof(vm->audio_pattern); i++)
+        vm->audio_pattern[i] = vm->mem[(CPU(vm)->I + i) & 0x0FFFu];
+
+    vm->internal_flags |= CH8_VM_AUDIO_PATTERN;
+}
+
+
+//> XO-CHIP: set the pitch the audio pattern is played at to the value of register Vx.
+void
+CH8_INSTR_Fx3A(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    uint8_t x = op->x;
+
+    vm->pitch = CPU(vm)->V[x];
+}
+
+
+/*** Superinstructions ********************************************************/
+
+// A superinstruction executes the instruction of op followed by the one decoded in
+// the next entry, op + 1. The program counter is advanced in between like the caller
+// would do, so skips of the second instruction work as usual. The first instruction
+// of a pair never skips, jumps or writes to memory, so the second one is always
+// executed as decoded.
+
+
+//> 6xkk 6xkk: store two numbers in registers.
+void
+CH8_INSTR_6xkk_6xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CPU(vm)->V[op[0].x] = op[0].kk;
+    CPU(vm)->pc += 2;
+    CPU(vm)->V[op[1].x] = op[1].kk;
+}
+
+
+//> 6xkk Ex9E: load a key number and skip if that key is pressed.
+void
+CH8_INSTR_6xkk_Ex9E(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CPU(vm)->V[op[0].x] = op[0].kk;
+    CPU(vm)->pc += 2;
+    if (vm->keypad[CPU(vm)->V[op[1].x] & 0x0Fu])
+        CPU(vm)->pc += 2;
+}
+
+
+//> 6xkk ExA1: load a key number and skip if that key is not pressed.
+void
+CH8_INSTR_6xkk_ExA1(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CPU(vm)->V[op[0].x] = op[0].kk;
+    CPU(vm)->pc += 2;
+    if (!vm->keypad[CPU(vm)->V[op[1].x] & 0x0Fu])
+        CPU(vm)->pc += 2;
+}
+
+
+//> 7xkk 3xkk: add to a register, then skip if a register equals kk. Typically the
+//  counter of a loop.
+void
+CH8_INSTR_7xkk_3xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CPU(vm)->V[op[0].x] += op[0].kk;
+    CPU(vm)->pc += 2;
+    if (CPU(vm)->V[op[1].x] == op[1].kk)
+        CPU(vm)->pc += 2;
+}
+
+
+//> Annn Dxyn: point I to a sprite and draw it.
+void
+CH8_INSTR_Annn_Dxyn(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CPU(vm)->I = op[0].nnn;
+    CPU(vm)->pc += 2;
+    CH8_INSTR_Dxyn(vm, &op[1]);
+}
+
+
+//> Fx07 3xkk: read the delay timer, then skip if a register equals kk. Typically
+//  polling the timer until it has run out.
+void
+CH8_INSTR_Fx07_3xkk(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CPU(vm)->V[op[0].x] = CPU(vm)->delay_timer;
+    CPU(vm)->pc += 2;
+    if (CPU(vm)->V[op[1].x] == op[1].kk)
+        CPU(vm)->pc += 2;
+}
+
+
 //> Execute chip8 instruction of type 0 with ending b
 int
-CH8_INSTR_000b(CH8_VM *vm)
+CH8_INSTR_000b(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    if ((vm->current_opcode & 0x0FFFu) != 0x00E0 && (vm->current_opcode & 0x0FFFu) != 0x00EE) {
-        CH8_INSTR_0nnn(vm);
+    if ((op->opcode & 0x0FFFu) != 0x00E0 && (op->opcode & 0x0FFFu) != 0x00EE) {
+        CH8_INSTR_0nnn(vm, op);
         return CH8_VM_SUCCESS;
     }
 
-    switch (vm->current_opcode & 0x000Fu) {
+    switch (op->opcode & 0x000Fu) {
         case 0x0000:
-            CH8_INSTR_00E0(vm);
+            CH8_INSTR_00E0(vm, op);
             break;
 
         case 0x000E:
-            CH8_INSTR_00EE(vm);
+            CH8_INSTR_00EE(vm, op);
             break;
 
         default:
            CH8_VM_DBG_log(__func__,
                    "Unsupported opcode: %x. Terminate execution.\n",
-                   vm->current_opcode);
+                   op->opcode);
             return CH8_VM_UNSUPPORTED_OPCODE;
     }
     return CH8_VM_SUCCESS;
@@ -551,49 +702,49 @@ CH8_INSTR_000b(CH8_VM *vm)
 
 //> Execute chip8 instruction of type 8 with ending b
 int
-CH8_INSTR_8xyb(CH8_VM *vm)
+CH8_INSTR_8xyb(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    switch (vm->current_opcode & 0x000Fu) {
+    switch (op->opcode & 0x000Fu) {
         case 0x0000:
-            CH8_INSTR_8xy0(vm);
+            CH8_INSTR_8xy0(vm, op);
             break;
 
         case 0x0001:
-            CH8_INSTR_8xy1(vm);
+            CH8_INSTR_8xy1(vm, op);
             break;
 
         case 0x0002:
-            CH8_INSTR_8xy2(vm);
+            CH8_INSTR_8xy2(vm, op);
             break;
 
         case 0x0003:
-            CH8_INSTR_8xy3(vm);
+            CH8_INSTR_8xy3(vm, op);
             break;
 
         case 0x0004:
-            CH8_INSTR_8xy4(vm);
+            CH8_INSTR_8xy4(vm, op);
             break;
 
         case 0x0005:
-            CH8_INSTR_8xy5(vm);
+            CH8_INSTR_8xy5(vm, op);
             break;
 
         case 0x0006:
-            CH8_INSTR_8xy6(vm);
+            CH8_INSTR_8xy6(vm, op);
             break;
 
         case 0x0007:
-            CH8_INSTR_8xy7(vm);
+            CH8_INSTR_8xy7(vm, op);
             break;
 
         case 0x000E:
-            CH8_INSTR_8xyE(vm);
+            CH8_INSTR_8xyE(vm, op);
             break;
 
         default:
             CH8_VM_DBG_log(__func__,
                     "Unsupported opcode: %x. Terminate execution.\n",
-                    vm->current_opcode);
+                    op->opcode);
             return CH8_VM_UNSUPPORTED_OPCODE;
     }
     return CH8_VM_SUCCESS;
@@ -602,21 +753,21 @@ CH8_INSTR_8xyb(CH8_VM *vm)
 
 //> Execute chip8 instruction of type E with ending bb
 int
-CH8_INSTR_Exbb(CH8_VM *vm)
+CH8_INSTR_Exbb(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    switch (vm->current_opcode & 0x00FFu) {
+    switch (op->opcode & 0x00FFu) {
         case 0x009E:
-            CH8_INSTR_Ex9E(vm);
+            CH8_INSTR_Ex9E(vm, op);
             break;
 
         case 0x00A1:
-            CH8_INSTR_ExA1(vm);
+            CH8_INSTR_ExA1(vm, op);
             break;
 
         default:
             CH8_VM_DBG_log(__func__,
                     "Unsupported opcode: %x. Terminate execution.\n",
-                    vm->current_opcode);
+                    op->opcode);
             return CH8_VM_UNSUPPORTED_OPCODE;
     }
     return CH8_VM_SUCCESS;
@@ -625,127 +776,142 @@ CH8_INSTR_Exbb(CH8_VM *vm)
 
 //> Execute chip8 instruction of type F with ending bb
 int
-CH8_INSTR_Fxbb(CH8_VM *vm)
+CH8_INSTR_Fxbb(CH8_VM *vm, const CH8_INSTR_decoded *op)
 {
-    switch (vm->current_opcode & 0x00FFu) {
+    switch (op->opcode & 0x00FFu) {
         case 0x0007:
-            CH8_INSTR_Fx07(vm);
+            CH8_INSTR_Fx07(vm, op);
             break;
 
         case 0x000A:
-            CH8_INSTR_Fx0A(vm);
+            CH8_INSTR_Fx0A(vm, op);
             break;
 
         case 0x0015:
-            CH8_INSTR_Fx15(vm);
+            CH8_INSTR_Fx15(vm, op);
             break;
 
         case 0x0018:
-            CH8_INSTR_Fx18(vm);
+            CH8_INSTR_Fx18(vm, op);
             break;
 
         case 0x001E:
-            CH8_INSTR_Fx1E(vm);
+            CH8_INSTR_Fx1E(vm, op);
             break;
 
         case 0x0029:
-            CH8_INSTR_Fx29(vm);
+            CH8_INSTR_Fx29(vm, op);
             break;
 
         case 0x0033:
-            CH8_INSTR_Fx33(vm);
+            CH8_INSTR_Fx33(vm, op);
             break;
 
         case 0x0055:
-            CH8_INSTR_Fx55(vm);
+            CH8_INSTR_Fx55(vm, op);
             break;
 
         case 0x0065:
-            CH8_INSTR_Fx65(vm);
+            CH8_INSTR_Fx65(vm, op);
             break;
 
+        case 0x003A:
+            CH8_INSTR_Fx3A(vm, op);
+            break;
+
+        case 0x0002:
+            if (op->x == 0) {
+                CH8_INSTR_F002(vm, op);
+                break;
+            }
+            // fall through - only F002 is defined
+
         default:
             CH8_VM_DBG_log(__func__,
                     "Unsupported opcode: %x. Terminate execution.\n",
-                    vm->current_opcode);
+                    op->opcode);
             return CH8_VM_UNSUPPORTED_OPCODE;
     }
     return CH8_VM_SUCCESS;
 }
 
 
-//> execute current opcode stored in vm
+//> execute current opcode stored in vm by selecting its implementation with nested
+//  switches
 int
-CH8_INSTR_exec(CH8_VM *vm)
+CH8_INSTR_exec_switch(CH8_VM *vm)
 {
+    CH8_INSTR_decoded op;
+    CH8_INSTR_decode_operands(vm->current_opcode, &op);
+
     // instructions of type b can throw error codes as they also select instructions
     // based on the opcode
-    switch (vm->current_opcode & 0xF000) {
+    switch (op.opcode & 0xF000) {
         case 0x0000:
-            if (CH8_INSTR_000b(vm) == CH8_VM_UNSUPPORTED_OPCODE)
+            if (CH8_INSTR_000b(vm, &op) == CH8_VM_UNSUPPORTED_OPCODE)
                 return CH8_VM_UNSUPPORTED_OPCODE;
             break;
 
         case 0x1000:
-            CH8_INSTR_1nnn(vm);
+            CH8_INSTR_1nnn(vm, &op);
             break;
 
         case 0x2000:
-            CH8_INSTR_2nnn(vm);
+            CH8_INSTR_2nnn(vm, &op);
             break;
 
         case 0x3000:
-            CH8_INSTR_3xkk(vm);
+            CH8_INSTR_3xkk(vm, &op);
             break;
 
         case 0x4000:
-            CH8_INSTR_4xkk(vm);
+            CH8_INSTR_4xkk(vm, &op);
             break;
 
         case 0x5000:
-            CH8_INSTR_5xy0(vm);
+            CH8_INSTR_5xy0(vm, &op);
             break;
 
         case 0x6000:
-            CH8_INSTR_6xkk(vm);
+            CH8_INSTR_6xkk(vm, &op);
             break;
 
         case 0x7000:
-            CH8_INSTR_7xkk(vm);
+            CH8_INSTR_7xkk(vm, &op);
             break;
 
         case 0x8000:
-            if (CH8_INSTR_8xyb(vm) == CH8_VM_UNSUPPORTED_OPCODE)
+            if (CH8_INSTR_8xyb(vm, &op) == CH8_VM_UNSUPPORTED_OPCODE)
                 return CH8_VM_UNSUPPORTED_OPCODE;
             break;
 
         case 0x9000:
-            CH8_INSTR_9xy0(vm);
+            CH8_INSTR_9xy0(vm, &op);
             break;
 
         case 0xA000:
-            CH8_INSTR_Annn(vm);
+            CH8_INSTR_Annn(vm, &op);
             break;
 
         case 0xB000:
-            CH8_INSTR_Bnnn(vm);
+            CH8_INSTR_Bnnn(vm, &op);
             break;
 
         case 0xC000:
-            CH8_INSTR_Cxkk(vm);
+            CH8_INSTR_Cxkk(vm, &op);
             break;
 
         case 0xD000:
-            CH8_INSTR_Dxyn(vm);
+            CH8_INSTR_Dxyn(vm, &op);
             break;
 
         case 0xE000:
-            if (CH8_INSTR_Exbb(vm) == CH8_VM_UNSUPPORTED_OPCODE)
+            if (CH8_INSTR_Exbb(vm, &op) == CH8_VM_UNSUPPORTED_OPCODE)
                 return CH8_VM_UNSUPPORTED_OPCODE;
             break;
 
         case 0xF000:
-            if (CH8_INSTR_Fxbb(vm) == CH8_VM_UNSUPPORTED_OPCODE)
+            if (CH8_INSTR_Fxbb(vm, &op) == CH8_VM_UNSUPPORTED_OPCODE)
                 return CH8_VM_UNSUPPORTED_OPCODE;
             break;
 
@@ -758,3 +924,232 @@ CH8_INSTR_exec(CH8_VM *vm)
     }
     return CH8_VM_SUCCESS;
 }
+
+
+/*** Table driven dispatch ****************************************************/
+
+
+static CH8_INSTR_handler dispatch_table[0x10000]; // one entry per possible opcode
+static pthread_once_t dispatch_table_once = PTHREAD_ONCE_INIT;
+
+
+//> Returns the implementation of an opcode, or NULL if the opcode is unsupported.
+CH8_INSTR_handler
+CH8_INSTR_lookup(uint16_t opcode)
+{
+    switch (opcode & 0xF000u) {
+        case 0x0000:
+            if ((opcode & 0x0FFFu) == 0x00E0) return CH8_INSTR_00E0;
+            if ((opcode & 0x0FFFu) == 0x00EE) return CH8_INSTR_00EE;
+            return CH8_INSTR_0nnn;
+
+        case 0x1000: return CH8_INSTR_1nnn;
+        case 0x2000: return CH8_INSTR_2nnn;
+        case 0x3000: return CH8_INSTR_3xkk;
+        case 0x4000: return CH8_INSTR_4xkk;
+        case 0x5000: return CH8_INSTR_5xy0;
+        case 0x6000: return CH8_INSTR_6xkk;
+        case 0x7000: return CH8_INSTR_7xkk;
+
+        case 0x8000:
+            switch (opcode & 0x000Fu) {
+                case 0x0000: return CH8_INSTR_8xy0;
+                case 0x0001: return CH8_INSTR_8xy1;
+                case 0x0002: return CH8_INSTR_8xy2;
+                case 0x0003: return CH8_INSTR_8xy3;
+                case 0x0004: return CH8_INSTR_8xy4;
+                case 0x0005: return CH8_INSTR_8xy5;
+                case 0x0006: return CH8_INSTR_8xy6;
+                case 0x0007: return CH8_INSTR_8xy7;
+                case 0x000E: return CH8_INSTR_8xyE;
+                default:     return NULL;
+            }
+
+        case 0x9000: return CH8_INSTR_9xy0;
+        case 0xA000: return CH8_INSTR_Annn;
+        case 0xB000: return CH8_INSTR_Bnnn;
+        case 0xC000: return CH8_INSTR_Cxkk;
+        case 0xD000: return CH8_INSTR_Dxyn;
+
+        case 0xE000:
+            switch (opcode & 0x00FFu) {
+                case 0x009E: return CH8_INSTR_Ex9E;
+                case 0x00A1: return CH8_INSTR_ExA1;
+                default:     return NULL;
+            }
+
+        case 0xF000:
+            switch (opcode & 0x00FFu) {
+                case 0x0007: return CH8_INSTR_Fx07;
+                case 0x000A: return CH8_INSTR_Fx0A;
+                case 0x0015: return CH8_INSTR_Fx15;
+                case 0x0018: return CH8_INSTR_Fx18;
+                case 0x001E: return CH8_INSTR_Fx1E;
+                case 0x0029: return CH8_INSTR_Fx29;
+                case 0x0033: return CH8_INSTR_Fx33;
+                case 0x0055: return CH8_INSTR_Fx55;
+                case 0x0065: return CH8_INSTR_Fx65;
+                case 0x003A: return CH8_INSTR_Fx3A;
+                case 0x0002: return opcode == 0xF002u ? CH8_INSTR_F002 : NULL;
+                default:     return NULL;
+            }
+
+        default:
+            return NULL;
+    }
+}
+
+
+static void
+fill_dispatch_table(void)
+{
+    for (uint32_t opcode = 0; opcode <= 0xFFFFu; opcode++) {
+        CH8_INSTR_handler handler = CH8_INSTR_lookup((uint16_t) opcode);
+        dispatch_table[opcode] = handler ? handler : CH8_INSTR_unsupported;
+    }
+}
+
+
+//> Fills the dispatch table. Only the first call does any work, and calls from other
+//  threads return once it is filled, so vms can be initialized on any thread.
+void
+CH8_INSTR_init_dispatch_table(void)
+{
+    pthread_once(&dispatch_table_once, fill_dispatch_table);
+}
+
+
+//> Extracts the operands of an opcode, leaving the handler untouched.
+void
+CH8_INSTR_decode_operands(uint16_t opcode, CH8_INSTR_decoded *op)
+{
+    op->opcode = opcode;
+    op->nnn    = NNN(opcode);
+    op->x      = X(opcode);
+    op->y      = Y(opcode);
+    op->n      = N(opcode);
+    op->kk     = KK(opcode);
+    op->len    = 1;
+}
+
+
+//> Decodes an opcode into its handler and operands.
+void
+CH8_INSTR_decode(uint16_t opcode, CH8_INSTR_decoded *op)
+{
+    op->handler = dispatch_table[opcode];
+    CH8_INSTR_decode_operands(opcode, op);
+}
+
+
+//> Replaces the handler of a decoded instruction with a superinstruction if it forms
+//  a fusable pair with the instruction decoded in op + 1. Returns the number of
+//  instructions executed by the handler of op.
+int
+CH8_INSTR_fuse(CH8_INSTR_decoded *op)
+{
+    // op + 1 may already be fused itself, so pairs are matched by plain handlers
+    CH8_INSTR_handler first  = dispatch_table[op[0].opcode];
+    CH8_INSTR_handler second = dispatch_table[op[1].opcode];
+    CH8_INSTR_handler fused  = NULL;
+
+    if (first == CH8_INSTR_6xkk && second == CH8_INSTR_6xkk)
+        fused = CH8_INSTR_6xkk_6xkk;
+    else if (first == CH8_INSTR_6xkk && second == CH8_INSTR_Ex9E)
+        fused = CH8_INSTR_6xkk_Ex9E;
+    else if (first == CH8_INSTR_6xkk && second == CH8_INSTR_ExA1)
+        fused = CH8_INSTR_6xkk_ExA1;
+    else if (first == CH8_INSTR_7xkk && second == CH8_INSTR_3xkk)
+        fused = CH8_INSTR_7xkk_3xkk;
+    else if (first == CH8_INSTR_Annn && second == CH8_INSTR_Dxyn)
+        fused = CH8_INSTR_Annn_Dxyn;
+    else if (first == CH8_INSTR_Fx07 && second == CH8_INSTR_3xkk)
+        fused = CH8_INSTR_Fx07_3xkk;
+
+    if (fused == NULL)
+        return op->len;
+
+    op->handler = fused;
+    op->len     = 2;
+    return 2;
+}
+
+
+
+//> Handler of opcodes that are not supported. Flags the vm as faulted, which makes
+//  the current cycle report CH8_VM_UNSUPPORTED_OPCODE.
+void
+CH8_INSTR_unsupported(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CH8_VM_DBG_log(__func__,
+                   "Unsupported opcode: %x. Terminate execution.\n",
+                   op->opcode);
+    vm->internal_flags |= CH8_VM_FAULT;
+}
+
+
+//> Handler of not yet decoded entries in the decoded instruction cache of a vm.
+//  Decodes the instruction at the address of the entry into the cache and executes
+//  it, so following executions of that address skip fetching and decoding.
+void
+CH8_INSTR_decode_miss(CH8_VM *vm, const CH8_INSTR_decoded *op)
+{
+    CH8_INSTR_decoded *entry = &vm->decoded[op - vm->decoded];
+    uint16_t addr = (uint16_t)((op - vm->decoded) << 1u);
+
+    CH8_INSTR_decode(vm->mem[addr] << 8u | vm->mem[addr + 1], entry);
+
+    // superinstructions read the operands of the following entry, so they have to be
+    // decoded as well. Its handler is left to this one, so the entry is fused like
+    // any other once it is executed itself and the cache doesn't depend on the order
+    // instructions were first executed in, which save states rely on.
+    if (!(vm->opt_flags & CH8_VM_NO_FUSION) && addr + 2 < CH8_VM_MEM_SIZE - 1) {
+        CH8_INSTR_decoded *next = entry + 1;
+        if (next->handler == CH8_INSTR_decode_miss)
+            CH8_INSTR_decode_operands(vm->mem[addr + 2] << 8u | vm->mem[addr + 3], next);
+        CH8_INSTR_fuse(entry);
+    }
+
+    vm->current_opcode = entry->opcode;
+    entry->handler(vm, entry);
+}
+
+
+//> Returns whether a decoded instruction may change the program counter or write to
+//  memory, which ends a basic block.
+int
+CH8_INSTR_ends_block(const CH8_INSTR_decoded *op)
+{
+    CH8_INSTR_handler h = op->handler;
+
+    return h == CH8_INSTR_00EE || h == CH8_INSTR_1nnn || h == CH8_INSTR_2nnn ||
+           h == CH8_INSTR_3xkk || h == CH8_INSTR_4xkk || h == CH8_INSTR_5xy0 ||
+           h == CH8_INSTR_9xy0 || h == CH8_INSTR_Bnnn || h == CH8_INSTR_Ex9E ||
+           h == CH8_INSTR_ExA1 || h == CH8_INSTR_Fx0A || h == CH8_INSTR_Fx33 ||
+           h == CH8_INSTR_Fx55 || h == CH8_INSTR_unsupported;
+}
+
+
+//> execute current opcode stored in vm with a single lookup in the dispatch table
+int
+CH8_INSTR_exec_table(CH8_VM *vm)
+{
+    CH8_INSTR_decoded op;
+    CH8_INSTR_decode(vm->current_opcode, &op);
+
+    op.handler(vm, &op);
+    return vm->internal_flags & CH8_VM_FAULT ? CH8_VM_UNSUPPORTED_OPCODE : CH8_VM_SUCCESS;
+}
+
+
+//> execute current opcode stored in vm. The dispatch strategy is chosen at build
+//  time with the CH8_TABLE_DISPATCH option.
+int
+CH8_INSTR_exec(CH8_VM *vm)
+{
+#ifdef CH8_TABLE_DISPATCH
+    return CH8_INSTR_exec_table(vm);
+#else
+    return CH8_INSTR_exec_switch(vm);
+#endif
+}
@@ -30,89 +30,130 @@
 
 /*** Opcode implementations */
 
-void CH8_INSTR_0nnn(CH8_VM *vm);
+void CH8_INSTR_0nnn(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_00E0(CH8_VM *vm);
+void CH8_INSTR_00E0(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_00EE(CH8_VM *vm);
+void CH8_INSTR_00EE(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_1nnn(CH8_VM *vm);
+void CH8_INSTR_1nnn(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_2nnn(CH8_VM *vm);
+void CH8_INSTR_2nnn(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_3xkk(CH8_VM *vm);
+void CH8_INSTR_3xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_4xkk(CH8_VM *vm);
+void CH8_INSTR_4xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_5xy0(CH8_VM *vm);
+void CH8_INSTR_5xy0(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_6xkk(CH8_VM *vm);
+void CH8_INSTR_6xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_7xkk(CH8_VM *vm);
+void CH8_INSTR_7xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy0(CH8_VM *vm);
+void CH8_INSTR_8xy0(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy1(CH8_VM *vm);
+void CH8_INSTR_8xy1(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy2(CH8_VM *vm);
+void CH8_INSTR_8xy2(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy3(CH8_VM *vm);
+void CH8_INSTR_8xy3(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy4(CH8_VM *vm);
+void CH8_INSTR_8xy4(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy5(CH8_VM *vm);
+void CH8_INSTR_8xy5(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy6(CH8_VM *vm);
+void CH8_INSTR_8xy6(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xy7(CH8_VM *vm);
+void CH8_INSTR_8xy7(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_8xyE(CH8_VM *vm);
+void CH8_INSTR_8xyE(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_9xy0(CH8_VM *vm);
+void CH8_INSTR_9xy0(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Annn(CH8_VM *vm);
+void CH8_INSTR_Annn(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Bnnn(CH8_VM *vm);
+void CH8_INSTR_Bnnn(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Cxkk(CH8_VM *vm);
+void CH8_INSTR_Cxkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Dxyn(CH8_VM *vm);
+void CH8_INSTR_Dxyn(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Ex9E(CH8_VM *vm);
+void CH8_INSTR_Ex9E(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_ExA1(CH8_VM *vm);
+void CH8_INSTR_ExA1(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx07(CH8_VM *vm);
+void CH8_INSTR_Fx07(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx0A(CH8_VM *vm);
+void CH8_INSTR_Fx0A(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx15(CH8_VM *vm);
+void CH8_INSTR_Fx15(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx18(CH8_VM *vm);
+void CH8_INSTR_Fx18(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx1E(CH8_VM *vm);
+void CH8_INSTR_Fx1E(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx29(CH8_VM *vm);
+void CH8_INSTR_Fx29(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx33(CH8_VM *vm);
+void CH8_INSTR_Fx33(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx55(CH8_VM *vm);
+void CH8_INSTR_Fx55(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-void CH8_INSTR_Fx65(CH8_VM *vm);
+void CH8_INSTR_Fx65(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_F002(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_Fx3A(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+/*** Superinstructions executing two adjacent instructions with a single dispatch */
+
+void CH8_INSTR_6xkk_6xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_6xkk_Ex9E(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_6xkk_ExA1(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_7xkk_3xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_Annn_Dxyn(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_Fx07_3xkk(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+int  CH8_INSTR_fuse(CH8_INSTR_decoded *op);
 
 /*** Opcode selector functions for opcodes of type 000_, 8xy_, Ex__, FX__.
  *** b represents variable part of opcode identifier */
 
-int  CH8_INSTR_000b(CH8_VM *vm);
+int  CH8_INSTR_000b(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-int  CH8_INSTR_8xyb(CH8_VM *vm);
+int  CH8_INSTR_8xyb(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-int  CH8_INSTR_Exbb(CH8_VM *vm);
+int  CH8_INSTR_Exbb(CH8_VM *vm, const CH8_INSTR_decoded *op);
 
-int  CH8_INSTR_Fxbb(CH8_VM *vm);
+int  CH8_INSTR_Fxbb(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+/*** Table driven dispatch. Every possible 16-bit opcode is mapped to its handler
+ *** once at startup, so executing an opcode is a single indexed call. */
+
+CH8_INSTR_handler CH8_INSTR_lookup(uint16_t opcode);
+
+void CH8_INSTR_init_dispatch_table(void);
+
+void CH8_INSTR_decode_operands(uint16_t opcode, CH8_INSTR_decoded *op);
+
+void CH8_INSTR_decode(uint16_t opcode, CH8_INSTR_decoded *op);
+
+void CH8_INSTR_unsupported(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+void CH8_INSTR_decode_miss(CH8_VM *vm, const CH8_INSTR_decoded *op);
+
+int  CH8_INSTR_ends_block(const CH8_INSTR_decoded *op);
 
 /*** Main function to execute an opcode */
 
+int  CH8_INSTR_exec_switch(CH8_VM *vm);
+
+int  CH8_INSTR_exec_table(CH8_VM *vm);
+
 int  CH8_INSTR_exec(CH8_VM *vm);
 
 #endif //CATASTROPHIC_CHIP8_INSTRUCTIONS_H
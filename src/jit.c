@@ -0,0 +1,459 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include "jit.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "instructions.h"
+
+#include "../rf/mystdlib.h"
+
+#if defined(CH8_JIT) && defined(__x86_64__) && defined(__unix__)
+#define CH8_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+
+/*** Native code generation for x86-64 ***********************************************
+ *
+ * A compiled block is a function void f(CH8_CPU *cpu) following the System V calling
+ * convention, so cpu is passed in rdi. It covers the leading micro-ops of a block that
+ * only operate on registers; everything from the first other instruction onwards is
+ * left to the interpreter.
+ *
+ * The V registers used by the compiled micro-ops live in host registers: they are
+ * loaded on entry, and the ones that have been written are stored back on exit. rax
+ * and rcx are scratch registers. All byte sized operations carry a REX prefix, so
+ * the low bytes of rsi and rbp are addressable as well.
+ */
+
+#ifdef CH8_JIT_X86_64
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RBP = 5, RSI = 6, RDI = 7,
+       R8 = 8, R9, R10, R11, R12, R13, R14, R15 };
+
+// host registers V registers are allocated from, caller-saved ones first
+static const int reg_pool[] = { RDX, RSI, R8, R9, R10, R11, RBX, RBP, R12, R13, R14, R15 };
+
+#define REG_POOL_SIZE ((int)(sizeof(reg_pool) / sizeof(reg_pool[0])))
+#define IS_CALLEE_SAVED(r) ((r) == RBX || (r) == RBP || (r) >= R12)
+
+#define OFF_V(i)  ((uint8_t)(offsetof(CH8_CPU, V) + (i)))
+#define OFF_I     ((uint8_t) offsetof(CH8_CPU, I))
+#define OFF_DT    ((uint8_t) offsetof(CH8_CPU, delay_timer))
+
+
+typedef struct emitter {
+    uint8_t *p;
+    int host[16]; // host register of each V register, -1 if not allocated
+} emitter;
+
+
+static void
+emit8(emitter *e, uint8_t b)
+{
+    *e->p++ = b;
+}
+
+
+static void
+emit_rex(emitter *e, int reg, int rm)
+{
+    emit8(e, 0x40u | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1));
+}
+
+
+//> <opc> rm8, reg8
+static void
+emit_rr8(emitter *e, uint8_t opc, int reg, int rm)
+{
+    emit_rex(e, reg, rm);
+    emit8(e, opc);
+    emit8(e, 0xC0u | (reg & 7) << 3 | (rm & 7));
+}
+
+
+//> <opc> [rdi + disp8], reg8 or <opc> reg8, [rdi + disp8]
+static void
+emit_mem8(emitter *e, uint8_t opc, int reg, uint8_t disp)
+{
+    emit_rex(e, reg, RDI);
+    emit8(e, opc);
+    emit8(e, 0x40u | (reg & 7) << 3 | RDI);
+    emit8(e, disp);
+}
+
+
+//> <opc> /ext rm8, imm8
+static void
+emit_ri8(emitter *e, uint8_t opc, int ext, int rm, uint8_t imm)
+{
+    emit_rex(e, 0, rm);
+    emit8(e, opc);
+    emit8(e, 0xC0u | ext << 3 | (rm & 7));
+    emit8(e, imm);
+}
+
+
+//> setcc rm8
+static void
+emit_setcc(emitter *e, uint8_t cc, int rm)
+{
+    emit_rex(e, 0, rm);
+    emit8(e, 0x0F);
+    emit8(e, cc);
+    emit8(e, 0xC0u | (rm & 7));
+}
+
+
+//> movzx eax, rm8
+static void
+emit_movzx_eax(emitter *e, int rm)
+{
+    emit_rex(e, RAX, rm);
+    emit8(e, 0x0F);
+    emit8(e, 0xB6);
+    emit8(e, 0xC0u | (rm & 7));
+}
+
+
+static void
+emit_push(emitter *e, int reg)
+{
+    if (reg >= R8) emit8(e, 0x41);
+    emit8(e, 0x50u + (reg & 7));
+}
+
+
+static void
+emit_pop(emitter *e, int reg)
+{
+    if (reg >= R8) emit8(e, 0x41);
+    emit8(e, 0x58u + (reg & 7));
+}
+
+
+#define MOV_RR   0x88 // mov rm8, reg8
+#define MOV_RM   0x8A // mov reg8, rm8
+#define OR_RR    0x08
+#define AND_RR   0x20
+#define XOR_RR   0x30
+#define ADD_RR   0x00
+#define SUB_RR   0x28
+#define CMP_RR   0x38
+#define SETC     0x92
+#define SETAE    0x93
+#define SETA     0x97
+
+#define VX(e, op) ((e)->host[(op)->x])
+#define VY(e, op) ((e)->host[(op)->y])
+#define VF(e)     ((e)->host[0xF])
+
+#define BIT(i) (1u << (i))
+
+
+//> Returns the V registers an instruction reads or writes, or -1 if the instruction
+//  can not be compiled.
+static int
+regs_used(const CH8_INSTR_decoded *op)
+{
+    CH8_INSTR_handler h = op->handler;
+
+    if (h == CH8_INSTR_0nnn || h == CH8_INSTR_Annn)
+        return 0;
+    if (h == CH8_INSTR_6xkk || h == CH8_INSTR_7xkk ||
+        h == CH8_INSTR_Fx15 || h == CH8_INSTR_Fx29)
+        return BIT(op->x);
+    if (h == CH8_INSTR_8xy0 || h == CH8_INSTR_8xy1 ||
+        h == CH8_INSTR_8xy2 || h == CH8_INSTR_8xy3)
+        return BIT(op->x) | BIT(op->y);
+    if (h == CH8_INSTR_8xy4 || h == CH8_INSTR_8xy5 || h == CH8_INSTR_8xy7)
+        return BIT(op->x) | BIT(op->y) | BIT(0xF);
+    if (h == CH8_INSTR_8xy6 || h == CH8_INSTR_8xyE || h == CH8_INSTR_Fx1E)
+        return BIT(op->x) | BIT(0xF);
+    return -1;
+}
+
+
+//> Returns the V registers an instruction writes.
+static int
+regs_written(const CH8_INSTR_decoded *op)
+{
+    CH8_INSTR_handler h = op->handler;
+
+    if (h == CH8_INSTR_6xkk || h == CH8_INSTR_7xkk ||
+        h == CH8_INSTR_8xy0 || h == CH8_INSTR_8xy1 ||
+        h == CH8_INSTR_8xy2 || h == CH8_INSTR_8xy3)
+        return BIT(op->x);
+    if (h == CH8_INSTR_8xy4 || h == CH8_INSTR_8xy5 || h == CH8_INSTR_8xy6 ||
+        h == CH8_INSTR_8xy7 || h == CH8_INSTR_8xyE)
+        return BIT(op->x) | BIT(0xF);
+    if (h == CH8_INSTR_Fx1E)
+        return BIT(0xF);
+    return 0;
+}
+
+
+//> Emits the native code of a single instruction. The order of reads and writes
+//  follows the interpreter, which matters when x or y is F.
+static void
+emit_op(emitter *e, const CH8_INSTR_decoded *op)
+{
+    CH8_INSTR_handler h = op->handler;
+
+    if (h == CH8_INSTR_6xkk) {
+        emit_rex(e, 0, VX(e, op));
+        emit8(e, 0xB0u + (VX(e, op) & 7)); // mov vx, kk
+        emit8(e, op->kk);
+    }
+    else if (h == CH8_INSTR_7xkk) {
+        emit_ri8(e, 0x80, 0, VX(e, op), op->kk); // add vx, kk
+    }
+    else if (h == CH8_INSTR_8xy0) {
+        emit_rr8(e, MOV_RR, VY(e, op), VX(e, op));
+    }
+    else if (h == CH8_INSTR_8xy1) {
+        emit_rr8(e, OR_RR, VY(e, op), VX(e, op));
+    }
+    else if (h == CH8_INSTR_8xy2) {
+        emit_rr8(e, AND_RR, VY(e, op), VX(e, op));
+    }
+    else if (h == CH8_INSTR_8xy3) {
+        emit_rr8(e, XOR_RR, VY(e, op), VX(e, op));
+    }
+    else if (h == CH8_INSTR_8xy4) {
+        emit_rr8(e, MOV_RR, VX(e, op), RAX); // al = vx + vy
+        emit_rr8(e, ADD_RR, VY(e, op), RAX);
+        emit_setcc(e, SETC, RCX);            // vf = carry
+        emit_rr8(e, MOV_RR, RCX, VF(e));
+        emit_rr8(e, MOV_RR, RAX, VX(e, op)); // vx = al
+    }
+    else if (h == CH8_INSTR_8xy5) {
+        emit_rr8(e, CMP_RR, VY(e, op), VX(e, op)); // vf = vx >= vy
+        emit_setcc(e, SETAE, RCX);
+        emit_rr8(e, MOV_RR, RCX, VF(e));
+        emit_rr8(e, SUB_RR, VY(e, op), VX(e, op)); // vx -= vy
+    }
+    else if (h == CH8_INSTR_8xy6) {
+        emit_rr8(e, MOV_RR, VX(e, op), RCX); // vf = vx & 1
+        emit_ri8(e, 0x80, 4, RCX, 0x01);
+        emit_rr8(e, MOV_RR, RCX, VF(e));
+        emit_rex(e, 0, VX(e, op));           // shr vx, 1
+        emit8(e, 0xD0);
+        emit8(e, 0xC0u | 5u << 3 | (VX(e, op) & 7));
+    }
+    else if (h == CH8_INSTR_8xy7) {
+        emit_rr8(e, CMP_RR, VX(e, op), VY(e, op)); // vf = vy >= vx
+        emit_setcc(e, SETAE, RCX);
+        emit_rr8(e, MOV_RR, RCX, VF(e));
+        emit_rr8(e, MOV_RR, VY(e, op), RAX);       // vx = vy - vx
+        emit_rr8(e, SUB_RR, VX(e, op), RAX);
+        emit_rr8(e, MOV_RR, RAX, VX(e, op));
+    }
+    else if (h == CH8_INSTR_8xyE) {
+        emit_rr8(e, MOV_RR, VX(e, op), RCX); // vf = vx >> 7
+        emit_ri8(e, 0xC0, 5, RCX, 7);
+        emit_rr8(e, MOV_RR, RCX, VF(e));
+        emit_rex(e, 0, VX(e, op));           // shl vx, 1
+        emit8(e, 0xD0);
+        emit8(e, 0xC0u | 4u << 3 | (VX(e, op) & 7));
+    }
+    else if (h == CH8_INSTR_Annn) {
+        emit8(e, 0x66);                      // mov word [cpu + I], nnn
+        emit8(e, 0xC7);
+        emit8(e, 0x40u | RDI);
+        emit8(e, OFF_I);
+        emit8(e, op->nnn & 0xFFu);
+        emit8(e, op->nnn >> 8u);
+    }
+    else if (h == CH8_INSTR_Fx15) {
+        emit_mem8(e, MOV_RR, VX(e, op), OFF_DT); // mov [cpu + delay_timer], vx
+    }
+    else if (h == CH8_INSTR_Fx1E) {
+        emit_movzx_eax(e, VX(e, op));        // ecx = I + vx
+        emit8(e, 0x0F);                      // movzx ecx, word [cpu + I]
+        emit8(e, 0xB7);
+        emit8(e, 0x40u | RCX << 3 | RDI);
+        emit8(e, OFF_I);
+        emit8(e, 0x01);                      // add ecx, eax
+        emit8(e, 0xC0u | RAX << 3 | RCX);
+        emit8(e, 0x81);                      // cmp ecx, 0xFFF
+        emit8(e, 0xC0u | 7u << 3 | RCX);
+        emit8(e, 0xFF); emit8(e, 0x0F); emit8(e, 0x00); emit8(e, 0x00);
+        emit_setcc(e, SETA, RAX);            // vf = ecx > 0xFFF
+        emit_rr8(e, MOV_RR, RAX, VF(e));
+        emit_movzx_eax(e, VX(e, op));        // I += vx
+        emit8(e, 0x66);
+        emit8(e, 0x01);
+        emit8(e, 0x40u | RAX << 3 | RDI);
+        emit8(e, OFF_I);
+    }
+    else if (h == CH8_INSTR_Fx29) {
+        emit_movzx_eax(e, VX(e, op));        // I = FONTSET_START_ADDR + vx * 5
+        emit8(e, 0x8D);                      // lea eax, [rax + rax * 4 + disp8]
+        emit8(e, 0x44);
+        emit8(e, 0x80);
+        emit8(e, CH8_VM_FONTSET_START_ADDR);
+        emit8(e, 0x66);                      // mov word [cpu + I], ax
+        emit8(e, 0x89);
+        emit8(e, 0x40u | RAX << 3 | RDI);
+        emit8(e, OFF_I);
+    }
+    // CH8_INSTR_0nnn is ignored
+}
+
+#endif // CH8_JIT_X86_64
+
+
+//> Returns whether blocks can be compiled to native code on this host.
+int
+CH8_JIT_is_supported(void)
+{
+#ifdef CH8_JIT_X86_64
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+//> Maps a new arena of executable memory, or returns NULL if native code is not
+//  supported on this host.
+CH8_JIT_arena *
+CH8_JIT_arena_create(void)
+{
+#ifdef CH8_JIT_X86_64
+    void *code = mmap(NULL, CH8_JIT_ARENA_SIZE, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return NULL;
+
+    CH8_JIT_arena *arena = calloc(1, sizeof(CH8_JIT_arena)); NP_CHECK(arena)
+    arena->code = code;
+    arena->size = CH8_JIT_ARENA_SIZE;
+    arena->used = 0;
+    return arena;
+#else
+    return NULL;
+#endif
+}
+
+
+//> Drops all code of an arena. Blocks that have been compiled into it must not be
+//  executed anymore.
+void
+CH8_JIT_arena_reset(CH8_JIT_arena *arena)
+{
+    if (arena != NULL)
+        arena->used = 0;
+}
+
+
+void
+CH8_JIT_arena_destroy(CH8_JIT_arena *arena)
+{
+#ifdef CH8_JIT_X86_64
+    if (arena == NULL)
+        return;
+    munmap(arena->code, arena->size);
+    free(arena);
+#else
+    (void) arena;
+#endif
+}
+
+
+//> Compiles the leading register-only micro-ops of a block into the arena and sets
+//  block->native and block->n_native accordingly. Returns the number of compiled
+//  micro-ops, which is 0 if nothing could be compiled.
+int
+CH8_JIT_compile(CH8_JIT_arena *arena, CH8_BLOCK *block)
+{
+#ifdef CH8_JIT_X86_64
+    if (arena == NULL || arena->size - arena->used < CH8_JIT_MAX_CODE_SIZE)
+        return 0;
+
+    // the last micro-op may change the program counter, so it is never compiled
+    unsigned int used = 0, written = 0;
+    uint16_t n = 0;
+    for (; n < block->tail; n++)
+    {
+        int regs = regs_used(&block->ops[n]);
+        if (regs < 0 || __builtin_popcount(used | (unsigned int) regs) > REG_POOL_SIZE)
+            break;
+        used    |= (unsigned int) regs;
+        written |= (unsigned int) regs_written(&block->ops[n]);
+    }
+    if (n == 0)
+        return 0;
+
+    uint8_t *start = arena->code + arena->used;
+    if (mprotect(arena->code, arena->size, PROT_READ | PROT_WRITE) != 0)
+        return 0;
+
+    emitter e = { .p = start };
+    int n_host = 0;
+    for (int v = 0; v < 16; v++)
+        e.host[v] = (used & BIT(v)) ? reg_pool[n_host++] : -1;
+
+    // prologue: save callee-saved registers and load the V registers
+    for (int i = 0; i < n_host; i++)
+        if (IS_CALLEE_SAVED(reg_pool[i]))
+            emit_push(&e, reg_pool[i]);
+    for (int v = 0; v < 16; v++)
+        if (e.host[v] >= 0)
+            emit_mem8(&e, MOV_RM, e.host[v], OFF_V(v));
+
+    for (uint16_t i = 0; i < n; i++)
+        emit_op(&e, &block->ops[i]);
+
+    // epilogue: store the written V registers and restore callee-saved registers
+    for (int v = 0; v < 16; v++)
+        if (written & BIT(v))
+            emit_mem8(&e, MOV_RR, e.host[v], OFF_V(v));
+    for (int i = n_host - 1; i >= 0; i--)
+        if (IS_CALLEE_SAVED(reg_pool[i]))
+            emit_pop(&e, reg_pool[i]);
+    emit8(&e, 0xC3); // ret
+
+    arena->used += (size_t)(e.p - start);
+    arena->used = (arena->used + 15u) & ~(size_t) 15u; // align the next block
+
+    if (mprotect(arena->code, arena->size, PROT_READ | PROT_EXEC) != 0)
+        return 0;
+
+    block->native   = (void (*)(CH8_CPU *)) start;
+    block->n_native = n;
+    return n;
+#else
+    (void) arena;
+    (void) block;
+    return 0;
+#endif
+}
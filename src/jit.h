@@ -0,0 +1,57 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_JIT_H
+#define CATASTROPHIC_CHIP8_JIT_H
+
+#include "block.h"
+
+
+typedef enum {
+    CH8_JIT_HOT_THRESHOLD = 32,         // executions after which a block is compiled
+    CH8_JIT_ARENA_SIZE    = 256 * 1024, // bytes of executable memory per vm
+    CH8_JIT_MAX_CODE_SIZE = 4096        // upper bound of the code size of one block
+} CH8_JIT_limits;
+
+
+// Arena of executable memory holding the native code of compiled blocks.
+typedef struct CH8_JIT_arena {
+    uint8_t *code;
+    size_t   size;
+    size_t   used;
+} CH8_JIT_arena;
+
+
+int  CH8_JIT_is_supported(void);
+
+CH8_JIT_arena *CH8_JIT_arena_create(void);
+
+void CH8_JIT_arena_reset(CH8_JIT_arena *arena);
+
+void CH8_JIT_arena_destroy(CH8_JIT_arena *arena);
+
+int  CH8_JIT_compile(CH8_JIT_arena *arena, CH8_BLOCK *block);
+
+#endif //CATASTROPHIC_CHIP8_JIT_H
@@ -0,0 +1,139 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#define _POSIX_C_SOURCE 200112L // clock_gettime, clock_nanosleep
+
+#include "timing.h"
+
+#include <errno.h>
+#include <time.h>
+
+#include "debug.h"
+
+
+//> Returns the time of the monotonic clock in nanoseconds. Unlike the process CPU time,
+//  it keeps running while the process sleeps, and unlike the wall clock it never jumps.
+uint64_t
+CH8_TIMING_now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * CH8_TIMING_NSEC_PER_SEC + (uint64_t) t.tv_nsec;
+}
+
+
+//> Sleeps until the monotonic clock reaches t_ns. Returns right away if it already has.
+void
+CH8_TIMING_sleep_until_ns(uint64_t t_ns)
+{
+    struct timespec t = {
+            .tv_sec  = (time_t)(t_ns / CH8_TIMING_NSEC_PER_SEC),
+            .tv_nsec = (long)(t_ns % CH8_TIMING_NSEC_PER_SEC)
+    };
+    // retries only if interrupted by a signal, the deadline stays the same. Other
+    // errors can't be fixed by retrying, so the sleep is given up on.
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+        ;
+}
+
+
+void
+CH8_TIMING_pacer_init(CH8_TIMING_pacer *pacer, uint64_t rate_hz, uint32_t max_catchup)
+{
+    pacer->rate_hz     = rate_hz;
+    pacer->max_catchup = max_catchup > 0 ? max_catchup : 1;
+    pacer->ticks       = 0;
+    pacer->dropped     = 0;
+    CH8_TIMING_pacer_reset(pacer);
+}
+
+
+//> Makes the next tick due now, e.g. after the caller has blocked for a while and
+//  doesn't want to catch up on the time.
+void
+CH8_TIMING_pacer_reset(CH8_TIMING_pacer *pacer)
+{
+    pacer->epoch_ns  = CH8_TIMING_now_ns();
+    pacer->scheduled = 0;
+}
+
+
+//> Returns the number of ticks that are due now and hands them out. At most
+//  max_catchup ticks are returned; if more are due, the older ones are dropped.
+uint32_t
+CH8_TIMING_pacer_due(CH8_TIMING_pacer *pacer)
+{
+    uint64_t elapsed = CH8_TIMING_now_ns() - pacer->epoch_ns;
+
+    // tick i is due at epoch + i / rate; multiplying first keeps fractional periods
+    // (like the 16.67 ms of 60 Hz) from accumulating rounding errors
+    uint64_t due_total = elapsed * pacer->rate_hz / CH8_TIMING_NSEC_PER_SEC + 1;
+    uint64_t due = due_total - pacer->scheduled;
+
+    if (due > pacer->max_catchup) {
+        pacer->dropped += due - pacer->max_catchup;
+        due = pacer->max_catchup;
+    }
+    pacer->scheduled = due_total;
+    pacer->ticks    += due;
+    return (uint32_t) due;
+}
+
+
+//> Sleeps until the next tick is due.
+void
+CH8_TIMING_pacer_wait(const CH8_TIMING_pacer *pacer)
+{
+    uint64_t next = (pacer->scheduled * CH8_TIMING_NSEC_PER_SEC + pacer->rate_hz - 1) / pacer->rate_hz;
+    CH8_TIMING_sleep_until_ns(pacer->epoch_ns + next);
+}
+
+
+void
+CH8_TIMING_stats_reset(CH8_TIMING_stats *stats, uint64_t now_ns)
+{
+    stats->since_ns    = now_ns;
+    stats->cycles      = 0;
+    stats->timer_ticks = 0;
+    stats->dropped     = 0;
+}
+
+
+//> Logs the achieved instruction and timer rates since the stats have been reset.
+void
+CH8_TIMING_stats_log(const CH8_TIMING_stats *stats, uint64_t now_ns,
+                     uint64_t target_cycles_hz, uint64_t target_ticks_hz)
+{
+    double sec = (double)(now_ns - stats->since_ns) / (double) CH8_TIMING_NSEC_PER_SEC;
+    if (sec <= 0.0)
+        return;
+
+    CH8_VM_DBG_log(__func__,
+                   "%.0f instructions/s (target %llu), timers %.2f Hz (target %llu), "
+                   "%llu frames dropped\n",
+                   (double) stats->cycles / sec, (unsigned long long) target_cycles_hz,
+                   (double) stats->timer_ticks / sec, (unsigned long long) target_ticks_hz,
+                   (unsigned long long) stats->dropped);
+}
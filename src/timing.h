@@ -0,0 +1,77 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_TIMING_H
+#define CATASTROPHIC_CHIP8_TIMING_H
+
+#include <stdint.h>
+
+
+#define CH8_TIMING_NSEC_PER_SEC 1000000000ull
+
+
+// Paces a periodic tick, like the 60 Hz frames of the vm, against the monotonic clock.
+// Ticks are due at absolute times, so time spent between two ticks doesn't add up to
+// drift. A pacer that has fallen behind catches up on at most max_catchup ticks at once
+// and drops older ones.
+typedef struct CH8_TIMING_pacer {
+    uint64_t epoch_ns;    // due time of the first tick
+    uint64_t rate_hz;     // ticks per second
+    uint64_t scheduled;   // ticks handed out since the epoch
+    uint32_t max_catchup; // ticks handed out at once at most
+
+    uint64_t ticks;       // ticks handed out in total
+    uint64_t dropped;     // ticks dropped in total
+} CH8_TIMING_pacer;
+
+
+// Achieved instruction and timer rates over an interval, for comparing with the rates
+// the vm should run at
+typedef struct CH8_TIMING_stats {
+    uint64_t since_ns;
+    uint64_t cycles;      // instructions executed or skipped while idle
+    uint64_t timer_ticks; // timer decrements
+    uint64_t dropped;     // ticks dropped by the pacer
+} CH8_TIMING_stats;
+
+
+uint64_t CH8_TIMING_now_ns(void);
+
+void     CH8_TIMING_sleep_until_ns(uint64_t t_ns);
+
+void     CH8_TIMING_pacer_init(CH8_TIMING_pacer *pacer, uint64_t rate_hz, uint32_t max_catchup);
+
+void     CH8_TIMING_pacer_reset(CH8_TIMING_pacer *pacer);
+
+uint32_t CH8_TIMING_pacer_due(CH8_TIMING_pacer *pacer);
+
+void     CH8_TIMING_pacer_wait(const CH8_TIMING_pacer *pacer);
+
+void     CH8_TIMING_stats_reset(CH8_TIMING_stats *stats, uint64_t now_ns);
+
+void     CH8_TIMING_stats_log(const CH8_TIMING_stats *stats, uint64_t now_ns,
+                              uint64_t target_cycles_hz, uint64_t target_ticks_hz);
+
+#endif //CATASTROPHIC_CHIP8_TIMING_H
@@ -28,11 +28,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
-
-#include <SDL2/SDL.h>
 
 #include "instructions.h"
+#include "block.h"
 #include "debug.h"
 
 #include "../rf/mystdlib.h"
@@ -58,67 +56,85 @@ static uint8_t fontset[CH8_VM_FONTSET_SIZE] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-//  Keymap on original chip 8 machine (http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#2.3)
-//  +---+---+---+---+
-//  | 1 | 2 | 3 | C |
-//  +---+---+---+---+
-//  | 4 | 5 | 6 | D |
-//  +---+---+---+---+
-//  | 7 | 8 | 9 | E |
-//  +---+---+---+---+
-//  | A | 0 | B | F |
-//  +---+---+---+---+
-uint8_t keymap[16] = {
-        SDLK_x,
-        SDLK_1,
-        SDLK_2,
-        SDLK_3,
-        SDLK_q,
-        SDLK_w,
-        SDLK_e,
-        SDLK_a,
-        SDLK_s,
-        SDLK_d,
-        SDLK_z,
-        SDLK_c,
-        SDLK_4,
-        SDLK_r,
-        SDLK_f,
-        SDLK_v,
-};
-
-
 //> Initializes a new chip8 vm.
 CH8_VM*
 CH8_VM_init(uint32_t opt_flags)
 {
-    CH8_VM *vm = calloc(1, sizeof(CH8_VM)); NP_CHECK(vm)
-    vm->cpu = calloc(1, sizeof(CH8_CPU)); NP_CHECK(vm->cpu)
-    srand(time(NULL)); // instruction Cxkk requires random numbers
+    void *storage = NULL;
+    if (posix_memalign(&storage, CH8_VM_ALIGN, sizeof(CH8_VM)) != 0)
+        storage = NULL;
+    NP_CHECK(storage)
+
+    CH8_VM *vm = storage;
+    CH8_VM_init_at(vm, opt_flags);
+    return vm;
+}
+
+
+//> Initializes a chip8 vm in storage of the caller, e.g. one element of an array of
+//  vms. The storage should be aligned to CH8_VM_ALIGN and is released with
+//  CH8_VM_release instead of CH8_VM_kill.
+void
+CH8_VM_init_at(CH8_VM *vm, uint32_t opt_flags)
+{
+    memset(vm, 0x00, sizeof(CH8_VM));
+    CH8_VM_seed(vm, 0); // instruction Cxkk requires random numbers
+    CH8_INSTR_init_dispatch_table();
 
+    CH8_VM_reset(vm, opt_flags);
+}
+
+
+//> Resets a vm to the state of a newly initialized one without reallocating it, e.g.
+//  to run many roms one after another with the same vm.
+void
+CH8_VM_reset(CH8_VM *vm, uint32_t opt_flags)
+{
     /*** CPU initialization */
 
-    memset(vm->cpu->V, 0x00, 16 * sizeof(uint8_t)); // clear V registers
-    memset(vm->cpu->stack, 0x00, 16 * sizeof(uint8_t)); // clear the stack
+    memset(vm->cpu.V, 0x00, sizeof(vm->cpu.V)); // clear V registers
+    memset(vm->cpu.stack, 0x00, sizeof(vm->cpu.stack)); // clear the stack
 
-    vm->cpu->I  = 0x0000;
-    vm->cpu->delay_timer = 0x00;
-    vm->cpu->sound_timer = 0x00;
-    vm->cpu->pc = CH8_VM_PROGRAM_START_ADDR;
+    vm->cpu.I  = 0x0000;
+    vm->cpu.sp = 0x00;
+    vm->cpu.delay_timer = 0x00;
+    vm->cpu.sound_timer = 0x00;
+    vm->cpu.pc = CH8_VM_PROGRAM_START_ADDR;
 
     vm->current_opcode    = 0x0000;
+    vm->cycles            = 0;
+    vm->skipped_cycles    = 0;
 
     /*** System initialization */
 
     memset(vm->mem, 0x00, CH8_VM_MEM_SIZE * sizeof(uint8_t)); // clear the memory
-    memset(vm->framebuffer, 0x00, CH8_VM_SCR_W * CH8_VM_SCR_H); // clear the screen
+    memset(vm->display, 0x00, sizeof(vm->display)); // clear the screen
+    vm->dirty_rows = 0xFFFFFFFF; // whatever was presented before has to be redrawn
     memcpy(vm->mem + CH8_VM_FONTSET_START_ADDR, fontset, CH8_VM_FONTSET_SIZE); // load the fontset
     memset(vm->keypad, 0x00, 16 * sizeof(uint8_t)); // init keyboard
+    memset(vm->audio_pattern, 0x00, sizeof(vm->audio_pattern));
+    vm->pitch = 64; // 4000 Hz
+    vm->rom_size = 0;
+
+    // translated blocks are only kept if they have been translated for the same engine
+    if (vm->blocks != NULL && vm->opt_flags != opt_flags) {
+        CH8_BLOCK_cache_destroy(vm->blocks);
+        vm->blocks = NULL;
+    }
 
     vm->opt_flags      = 0x00 | opt_flags; // set options
     vm->internal_flags = 0x00; // used by internal functions only; should not be modified
 
-    return vm;
+    CH8_VM_invalidate(vm, CH8_VM_RAM_START_ADDR, CH8_VM_MEM_SIZE); // nothing decoded yet
+}
+
+
+//> Deallocates the memory a vm allocated while running, leaving its own storage to
+//  the caller (see CH8_VM_init_at).
+void
+CH8_VM_release(CH8_VM *vm)
+{
+    CH8_BLOCK_cache_destroy(vm->blocks); vm->blocks = NULL;
 }
 
 
@@ -126,7 +142,7 @@ CH8_VM_init(uint32_t opt_flags)
 void
 CH8_VM_kill(CH8_VM *vm)
 {
-    free(vm->cpu); vm->cpu = NULL;
+    CH8_VM_release(vm);
     free(vm); vm = NULL;
 }
 
@@ -152,20 +168,401 @@ CH8_VM_load_rom(CH8_VM *vm, const char *fpath)
         CH8_VM_DBG_log(__func__,
                 "Rom size out of bounds: %zu bytes (max is %zu). Terminate execution.\n",
                 sz, CH8_VM_MAX_PROGSIZE);
+        fclose(rom_fp);
         return CH8_VM_ROMSIZE_OUTOFBOUNDS;
     }
 
-    // read rom into memory from file
-    uint8_t b;
-    for (int i = 0; fread(&b, sizeof(b), 1, rom_fp) != 0; i++)
-    {
-        if (!feof(rom_fp))
-            vm->mem[CH8_VM_PROGRAM_START_ADDR + i] = b;
+    // read rom from file
+    uint8_t rom[CH8_VM_MAX_PROGSIZE];
+    sz = fread(rom, sizeof(rom[0]), sz, rom_fp);
+    fclose(rom_fp);
+
+    return CH8_VM_load_rom_buffer(vm, rom, sz);
+}
+
+
+//> Loads a compatible rom of size bytes from memory into chip8 memory.
+int
+CH8_VM_load_rom_buffer(CH8_VM *vm, const uint8_t *rom, size_t size)
+{
+    if (size > CH8_VM_MAX_PROGSIZE)
+        return CH8_VM_ROMSIZE_OUTOFBOUNDS;
+
+    memcpy(vm->mem + CH8_VM_PROGRAM_START_ADDR, rom, size);
+    memcpy(vm->rom, rom, size);
+    vm->rom_size = (uint16_t) size;
+
+    CH8_VM_invalidate(vm, CH8_VM_PROGRAM_START_ADDR, CH8_VM_MAX_PROGSIZE);
+    return CH8_VM_SUCCESS;
+}
+
+
+//> Returns a 64-bit FNV-1a hash of the emulated machine state, i.e. registers,
+//  memory and display, for comparing the outcome of runs.
+uint64_t
+CH8_VM_state_hash(const CH8_VM *vm)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+#define CH8_VM_HASH_BYTES(ptr, n)                                   \
+    for (size_t i_ = 0; i_ < (n); i_++)                             \
+        hash = (hash ^ ((const uint8_t *)(ptr))[i_]) * 0x100000001b3ull;
+
+    const CH8_CPU *cpu = &vm->cpu;
+    CH8_VM_HASH_BYTES(cpu->V, sizeof(cpu->V))
+    CH8_VM_HASH_BYTES(&cpu->I, sizeof(cpu->I))
+    CH8_VM_HASH_BYTES(&cpu->pc, sizeof(cpu->pc))
+    CH8_VM_HASH_BYTES(&cpu->sp, sizeof(cpu->sp))
+    CH8_VM_HASH_BYTES(&cpu->delay_timer, sizeof(cpu->delay_timer))
+    CH8_VM_HASH_BYTES(&cpu->sound_timer, sizeof(cpu->sound_timer))
+    CH8_VM_HASH_BYTES(cpu->stack, sizeof(cpu->stack))
+    CH8_VM_HASH_BYTES(vm->mem, sizeof(vm->mem))
+    CH8_VM_HASH_BYTES(vm->display, sizeof(vm->display))
+
+#undef CH8_VM_HASH_BYTES
+    return hash;
+}
+
+
+/*** Save states ******************************************************************/
+
+/*
+ * A save state is a little endian binary blob:
+ *
+ *   header    "CH8S", u16 version, u16 reserved (zero), u32 size of the state, u32
+ *             FNV-1a hash of the bytes after the header
+ *   rom       u32 FNV-1a hash and u16 size of the rom the state belongs to
+ *   cpu       V0-VF, u16 I, u16 pc, u8 sp, u8 delay timer, u8 sound timer, 16 x u16
+ *             stack
+ *   vm        u16 current opcode, u32 flags, u16 keys pressed, 4 x u32 generator
+ *             state, u8 pitch, 16 bytes audio pattern, u64 cycles, u64 skipped cycles
+ *   display   u32 mask of the rows with pixels set, then one u64 per row of the mask
+ *   memory    u16 number of runs, then per run u16 address, u16 length and its bytes
+ *
+ * Memory is stored as runs of bytes differing from the memory right after loading
+ * the rom, so the state of most roms takes a few hundred bytes.
+ */
+
+#define CH8_VM_STATE_VERSION     1
+#define CH8_VM_STATE_HEADER_SIZE 16
+#define CH8_VM_STATE_RUN_GAP     4 // unchanged bytes merged into a run at most, which
+                                   // cost less than the header of another run
+#define CH8_VM_STATE_FLAGS       (CH8_VM_AUDIO_PATTERN | CH8_VM_WAIT_KEY | CH8_VM_FAULT) // internal
+                                                                   // flags kept in states
+
+
+// Cursor of a save state being written or read. Accesses beyond the end of the buffer
+// set overflow instead.
+typedef struct state_cursor {
+    uint8_t *data;
+    size_t   size;
+    size_t   pos;
+    int      overflow;
+} state_cursor;
+
+
+static void
+put_bytes(state_cursor *c, const void *bytes, size_t n)
+{
+    if (c->overflow || c->size - c->pos < n) {
+        c->overflow = 1;
+        return;
     }
+    memcpy(c->data + c->pos, bytes, n);
+    c->pos += n;
+}
+
+
+static void
+put_uint(state_cursor *c, uint64_t v, int n_bytes)
+{
+    uint8_t bytes[8];
+    for (int i = 0; i < n_bytes; i++)
+        bytes[i] = (uint8_t) (v >> (8u * i));
+    put_bytes(c, bytes, n_bytes);
+}
+
+
+static void
+get_bytes(state_cursor *c, void *bytes, size_t n)
+{
+    if (c->overflow || c->size - c->pos < n) {
+        c->overflow = 1;
+        memset(bytes, 0x00, n);
+        return;
+    }
+    memcpy(bytes, c->data + c->pos, n);
+    c->pos += n;
+}
+
+
+static uint64_t
+get_uint(state_cursor *c, int n_bytes)
+{
+    uint8_t bytes[8];
+    get_bytes(c, bytes, n_bytes);
+
+    uint64_t v = 0;
+    for (int i = 0; i < n_bytes; i++)
+        v |= (uint64_t) bytes[i] << (8u * i);
+    return v;
+}
+
+
+static uint32_t
+fnv1a32(const uint8_t *bytes, size_t n)
+{
+    uint32_t hash = 0x811c9dc5u;
+    for (size_t i = 0; i < n; i++)
+        hash = (hash ^ bytes[i]) * 0x01000193u;
+    return hash;
+}
+
+
+//> Returns the byte at addr of the memory of a vm right after loading its rom.
+static inline uint8_t
+initial_mem(const CH8_VM *vm, uint32_t addr)
+{
+    if (addr >= CH8_VM_FONTSET_START_ADDR &&
+        addr < CH8_VM_FONTSET_START_ADDR + CH8_VM_FONTSET_SIZE)
+        return fontset[addr - CH8_VM_FONTSET_START_ADDR];
+    if (addr >= CH8_VM_PROGRAM_START_ADDR &&
+        addr < (uint32_t) CH8_VM_PROGRAM_START_ADDR + vm->rom_size)
+        return vm->rom[addr - CH8_VM_PROGRAM_START_ADDR];
+    return 0x00;
+}
+
+
+//> Writes the state of a vm to buffer, e.g. to restore it later with
+//  CH8_VM_load_state. Doesn't allocate, so states can be saved every frame. A buffer of
+//  CH8_VM_STATE_MAX_SIZE bytes holds any state. Returns the size of the state, or 0 if
+//  it doesn't fit into the buffer.
+size_t
+CH8_VM_save_state(const CH8_VM *vm, uint8_t *buffer, size_t size)
+{
+    state_cursor c = { .data = buffer, .size = size };
+
+    put_bytes(&c, "CH8S", 4);
+    put_uint(&c, CH8_VM_STATE_VERSION, 2);
+    put_uint(&c, 0, 2);
+    put_uint(&c, 0, 4); // size and hash, set once known
+    put_uint(&c, 0, 4);
+
+    put_uint(&c, fnv1a32(vm->rom, vm->rom_size), 4);
+    put_uint(&c, vm->rom_size, 2);
+
+    const CH8_CPU *cpu = &vm->cpu;
+    put_bytes(&c, cpu->V, sizeof(cpu->V));
+    put_uint(&c, cpu->I, 2);
+    put_uint(&c, cpu->pc, 2);
+    put_uint(&c, cpu->sp, 1);
+    put_uint(&c, cpu->delay_timer, 1);
+    put_uint(&c, cpu->sound_timer, 1);
+    for (int i = 0; i < 16; i++)
+        put_uint(&c, cpu->stack[i], 2);
+
+    uint16_t keys = 0;
+    for (int i = 0; i < 16; i++)
+        keys |= vm->keypad[i] ? 1u << i : 0u;
+
+    put_uint(&c, vm->current_opcode, 2);
+    put_uint(&c, vm->internal_flags & CH8_VM_STATE_FLAGS, 4);
+    put_uint(&c, keys, 2);
+    for (int i = 0; i < 4; i++)
+        put_uint(&c, vm->rng.s[i], 4);
+    put_uint(&c, vm->pitch, 1);
+    put_bytes(&c, vm->audio_pattern, sizeof(vm->audio_pattern));
+    put_uint(&c, vm->cycles, 8);
+    put_uint(&c, vm->skipped_cycles, 8);
+
+    uint32_t rows = 0;
+    for (int y = 0; y < CH8_VM_SCR_H; y++)
+        rows |= vm->display[y] ? 1u << y : 0u;
+    put_uint(&c, rows, 4);
+    for (int y = 0; y < CH8_VM_SCR_H; y++)
+        if (rows & (1u << y))
+            put_uint(&c, vm->display[y], 8);
+
+    // runs of changed bytes, counted once they are written
+    size_t n_runs_pos = c.pos;
+    uint16_t n_runs = 0;
+    put_uint(&c, 0, 2);
+
+    for (uint32_t addr = 0; addr < CH8_VM_MEM_SIZE; addr++) {
+        if (vm->mem[addr] == initial_mem(vm, addr))
+            continue;
+
+        uint32_t end = addr + 1;
+        for (uint32_t a = end; a < CH8_VM_MEM_SIZE && a <= end + CH8_VM_STATE_RUN_GAP; a++)
+            if (vm->mem[a] != initial_mem(vm, a))
+                end = a + 1;
+
+        put_uint(&c, addr, 2);
+        put_uint(&c, end - addr, 2);
+        put_bytes(&c, vm->mem + addr, end - addr);
+        n_runs++;
+        addr = end - 1;
+    }
+
+    if (c.overflow)
+        return 0;
+
+    size_t state_size = c.pos;
+    c.pos = n_runs_pos;
+    put_uint(&c, n_runs, 2);
+    c.pos = 8;
+    put_uint(&c, state_size, 4);
+    put_uint(&c, fnv1a32(buffer + CH8_VM_STATE_HEADER_SIZE, state_size - CH8_VM_STATE_HEADER_SIZE), 4);
+
+    return state_size;
+}
+
+
+//> Restores the state of a vm saved with CH8_VM_save_state. The vm must have loaded
+//  the rom the state belongs to. Returns CH8_VM_STATE_INVALID, leaving the vm
+//  untouched, if the state is corrupt, of another version or of another rom.
+int
+CH8_VM_load_state(CH8_VM *vm, const uint8_t *buffer, size_t size)
+{
+    state_cursor c = { .data = (uint8_t *) buffer, .size = size };
+
+    char magic[4];
+    get_bytes(&c, magic, 4);
+    uint64_t version    = get_uint(&c, 2);
+    uint64_t reserved   = get_uint(&c, 2);
+    uint64_t state_size = get_uint(&c, 4);
+    uint64_t hash       = get_uint(&c, 4);
+
+    // the header isn't covered by the hash, so reserved bytes must be zero
+    if (c.overflow || memcmp(magic, "CH8S", 4) != 0 || version != CH8_VM_STATE_VERSION ||
+        reserved != 0 || state_size < CH8_VM_STATE_HEADER_SIZE || state_size > size ||
+        hash != fnv1a32(buffer + CH8_VM_STATE_HEADER_SIZE, state_size - CH8_VM_STATE_HEADER_SIZE))
+        return CH8_VM_STATE_INVALID;
+    c.size = state_size;
+
+    uint64_t rom_hash = get_uint(&c, 4);
+    uint64_t rom_size = get_uint(&c, 2);
+    if (rom_hash != fnv1a32(vm->rom, vm->rom_size) || rom_size != vm->rom_size)
+        return CH8_VM_STATE_INVALID;
+
+    CH8_CPU cpu;
+    get_bytes(&c, cpu.V, sizeof(cpu.V));
+    cpu.I           = (reg16_t) get_uint(&c, 2);
+    cpu.pc          = (reg16_t) get_uint(&c, 2);
+    cpu.sp          = (reg8_t) get_uint(&c, 1);
+    cpu.delay_timer = (reg8_t) get_uint(&c, 1);
+    cpu.sound_timer = (reg8_t) get_uint(&c, 1);
+    for (int i = 0; i < 16; i++)
+        cpu.stack[i] = (uint16_t) get_uint(&c, 2);
+
+    uint16_t current_opcode = (uint16_t) get_uint(&c, 2);
+    uint32_t flags          = (uint32_t) get_uint(&c, 4) & CH8_VM_STATE_FLAGS;
+    uint16_t keys           = (uint16_t) get_uint(&c, 2);
+    CH8_VM_rng rng;
+    for (int i = 0; i < 4; i++)
+        rng.s[i] = (uint32_t) get_uint(&c, 4);
+    uint8_t pitch = (uint8_t) get_uint(&c, 1);
+    uint8_t audio_pattern[16];
+    get_bytes(&c, audio_pattern, sizeof(audio_pattern));
+    uint64_t cycles         = get_uint(&c, 8);
+    uint64_t skipped_cycles = get_uint(&c, 8);
+
+    uint64_t display[CH8_VM_SCR_H];
+    uint32_t rows = (uint32_t) get_uint(&c, 4);
+    for (int y = 0; y < CH8_VM_SCR_H; y++)
+        display[y] = rows & (1u << y) ? get_uint(&c, 8) : 0;
+
+    // the runs are checked before anything is restored
+    size_t runs_pos = c.pos;
+    uint64_t n_runs = get_uint(&c, 2);
+    for (uint64_t i = 0; i < n_runs && !c.overflow; i++) {
+        uint64_t addr = get_uint(&c, 2);
+        uint64_t len  = get_uint(&c, 2);
+        if (addr + len > CH8_VM_MEM_SIZE || c.size - c.pos < len)
+            return CH8_VM_STATE_INVALID;
+        c.pos += len;
+    }
+
+    // the program counter may be anywhere, fetches wrap around the end of memory
+    if (c.overflow || c.pos != state_size || cpu.sp > 0x0F)
+        return CH8_VM_STATE_INVALID;
+
+    /*** The state is valid, restore it */
+
+    vm->cpu            = cpu;
+    vm->current_opcode = current_opcode;
+    vm->rng            = rng;
+    vm->pitch          = pitch;
+    vm->cycles         = cycles;
+    vm->skipped_cycles = skipped_cycles;
+    memcpy(vm->audio_pattern, audio_pattern, sizeof(audio_pattern));
+    for (int i = 0; i < 16; i++)
+        vm->keypad[i] = (keys >> i) & 1u;
+
+    memcpy(vm->display, display, sizeof(display));
+    vm->dirty_rows = 0xFFFFFFFF;
+
+    for (uint32_t addr = 0; addr < CH8_VM_MEM_SIZE; addr++)
+        vm->mem[addr] = initial_mem(vm, addr);
+
+    // code translated ahead of time is only used if the code of the rom is unchanged
+    uint32_t code_changed = 0;
+    c.pos = runs_pos + 2;
+    for (uint64_t i = 0; i < n_runs; i++) {
+        uint32_t addr = (uint32_t) get_uint(&c, 2);
+        uint32_t len  = (uint32_t) get_uint(&c, 2);
+        get_bytes(&c, vm->mem + addr, len);
+        code_changed |= addr < (uint32_t) CH8_VM_PROGRAM_START_ADDR + vm->rom_size &&
+                        addr + len > CH8_VM_PROGRAM_START_ADDR;
+    }
+
+    vm->internal_flags = flags | CH8_VM_SCREEN_UPDATE | (code_changed ? CH8_VM_AOT_STALE : 0u);
+    CH8_VM_invalidate(vm, CH8_VM_RAM_START_ADDR, CH8_VM_MEM_SIZE);
     return CH8_VM_SUCCESS;
 }
 
 
+//> Seeds the random number generator of a vm. Roms drawing random numbers with Cxkk
+//  behave the same for the same seed, whichever engine executes them.
+void
+CH8_VM_seed(CH8_VM *vm, uint64_t seed)
+{
+    // splitmix64 spreads the seed over the whole state, which must not be all zero
+    for (int i = 0; i < 4; i += 2) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+        z ^= z >> 31u;
+        vm->rng.s[i]     = (uint32_t) z;
+        vm->rng.s[i + 1] = (uint32_t) (z >> 32u);
+    }
+}
+
+
+static inline uint32_t
+rotl32(uint32_t x, int k)
+{
+    return (x << k) | (x >> (32 - k));
+}
+
+
+//> Returns the next random number of a vm (xoshiro128**).
+uint32_t
+CH8_VM_random(CH8_VM *vm)
+{
+    uint32_t *s = vm->rng.s;
+    uint32_t result = rotl32(s[1] * 5u, 7) * 9u;
+    uint32_t t = s[1] << 9u;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl32(s[3], 11);
+    return result;
+}
+
+
 //> Returns whether drawflag is set and framebuffer has to be redrawn.
 int
 CH8_VM_is_drawflag_set(CH8_VM *vm)
@@ -182,66 +579,254 @@ CH8_VM_unset_drawflag(CH8_VM *vm)
 }
 
 
+//> Returns the rows of the display that differ from shown, the display as it was
+//  last presented, and updates shown. Only rows written since the last call are
+//  compared, and a row a sprite has been drawn to twice, erasing it again, doesn't
+//  count as changed. Returns 0 if there is nothing new to present.
+uint32_t
+CH8_VM_changed_rows(CH8_VM *vm, uint64_t *shown)
+{
+    uint32_t changed = 0;
+    for (uint32_t dirty = vm->dirty_rows; dirty; dirty &= dirty - 1) {
+        int row = __builtin_ctz(dirty);
+        if (shown[row] != vm->display[row]) {
+            shown[row] = vm->display[row];
+            changed |= 1u << row;
+        }
+    }
+    vm->dirty_rows = 0;
+    vm->internal_flags &= ~CH8_VM_SCREEN_UPDATE;
+    return changed;
+}
+
+
+//> Expands n_rows rows of a packed display starting at row to one 32-bit pixel per
+//  chip8 pixel, e.g. ARGB8888 for SDL textures. Each pixel is looked up in palette by
+//  its bit in display and its bit in previous, (display << 1) | previous, which allows
+//  blending two consecutive frames. Passing display as previous maps set pixels to
+//  palette[3] and the others to palette[0].
+void
+CH8_VM_expand_rows(const uint64_t *display, const uint64_t *previous, int row, int n_rows,
+                   uint32_t *pixels, const uint32_t palette[4])
+{
+    for (int end = row + n_rows; row < end; row++) {
+        uint64_t cur  = display[row];
+        uint64_t prev = previous[row];
+        for (int col = 0; col < CH8_VM_SCR_W; col++, cur <<= 1u, prev <<= 1u)
+            *pixels++ = palette[((cur >> 62u) & 2u) | (prev >> 63u)];
+    }
+}
+
+
+//> Returns the packed display of the vm, one uint64_t per row with the most
+//  significant bit being the leftmost pixel.
+const uint64_t *
+CH8_VM_get_display(const CH8_VM *vm)
+{
+    return vm->display;
+}
+
+
+//> Returns whether the pixel at x, y of the display is set.
+int
+CH8_VM_get_pixel(const CH8_VM *vm, uint8_t x, uint8_t y)
+{
+    return (int)((vm->display[y % CH8_VM_SCR_H] >> (63u - x % CH8_VM_SCR_W)) & 1u);
+}
+
+
+//> Returns whether the vm is beeping, i.e. its sound timer is running.
+int
+CH8_VM_is_sound_on(const CH8_VM *vm)
+{
+    return vm->cpu.sound_timer > 0 ? 1 : 0;
+}
+
+
+//> Returns whether the last instruction executed by the vm waits for the next timer
+//  decrement or a key press, like a jump closing a loop that polls the delay timer.
+//  Executing more instructions until then is a waste of host cycles.
+int
+CH8_VM_is_idle(CH8_VM *vm)
+{
+    return vm->internal_flags & CH8_VM_IDLE ? 1 : 0;
+}
+
+
+//> Returns whether the vm waits for a key press in Fx0A. Until a key is pressed with
+//  CH8_VM_set_key, running the vm executes nothing, so the host may block on its
+//  input (and the 60 Hz timer, while a timer is running) instead.
+int
+CH8_VM_is_waiting_for_key(CH8_VM *vm)
+{
+    return vm->internal_flags & CH8_VM_WAIT_KEY ? 1 : 0;
+}
+
+
+//> Sets the state of a key of the hexadecimal keypad. Pressing a key ends waiting
+//  for a key press.
+void
+CH8_VM_set_key(CH8_VM *vm, uint8_t key, int pressed)
+{
+    vm->keypad[key & 0x0Fu] = pressed ? 1u : 0u;
+    if (pressed)
+        vm->internal_flags &= ~CH8_VM_WAIT_KEY;
+}
+
+
+//> Sets the keypad to the keys held, bit k for key k. Keys tapped since the last call,
+//  bit k of tapped, stay pressed until the next call even if they have been released
+//  already, so the vm sees taps shorter than the time between two calls.
+void
+CH8_VM_set_keypad(CH8_VM *vm, uint16_t held, uint16_t tapped)
+{
+    uint16_t keys = held | tapped;
+
+    for (uint8_t key = 0; key < 16; key++)
+        if (vm->keypad[key] != ((keys >> key) & 1u))
+            CH8_VM_set_key(vm, key, (keys >> key) & 1u);
+}
+
+
 //> Decrements timers if they are set.
 void
 CH8_VM_decrement_timers(CH8_VM *vm)
 {
-    if (vm->cpu->delay_timer > 0) { vm->cpu->delay_timer--; }
-    if (vm->cpu->sound_timer > 0) { vm->cpu->sound_timer--; }
+    if (vm->cpu.delay_timer > 0) { vm->cpu.delay_timer--; }
+    if (vm->cpu.sound_timer > 0) { vm->cpu.sound_timer--; }
 }
 
 
-//> Emulates a single CPU cycle
-int
-CH8_VM_emulate_cycle(CH8_VM *vm)
+//> Drops decoded instructions overlapping the memory range [addr, addr + len), so
+//  they are decoded again from memory before their next execution. The range wraps
+//  around the end of memory like the stores of instructions do.
+void
+CH8_VM_invalidate(CH8_VM *vm, uint16_t addr, uint16_t len)
+{
+    if (len == 0)
+        return;
+    if (len > CH8_VM_MEM_SIZE)
+        len = CH8_VM_MEM_SIZE;
+
+    addr &= 0x0FFFu;
+    uint32_t last = (uint32_t) addr + len - 1;
+    if (last >= CH8_VM_MEM_SIZE) {
+        CH8_VM_invalidate(vm, 0, (uint16_t)(last - CH8_VM_MEM_SIZE + 1));
+        last = CH8_VM_MEM_SIZE - 1;
+        len  = (uint16_t)(CH8_VM_MEM_SIZE - addr);
+    }
+
+    // the entry before the range may hold a superinstruction reading the first one
+    uint32_t first = addr >> 1u;
+    if (first > 0)
+        first--;
+
+    for (uint32_t i = first; i <= last >> 1u; i++) {
+        vm->decoded[i].handler = CH8_INSTR_decode_miss;
+        vm->decoded[i].len     = 1;
+    }
+
+    CH8_BLOCK_invalidate(vm, addr, len);
+}
+
+
+//> Executes the instruction at the program counter, or the superinstruction cached
+//  for it if max_cycles allows executing two instructions.
+static inline int
+step(CH8_VM *vm, uint64_t max_cycles)
 {
     int rc;
 
-    // fetch the instruction
-    vm->current_opcode = vm->mem[vm->cpu->pc] << 8 | vm->mem[vm->cpu->pc + 1];
-    // execute the instruction
-    rc = CH8_INSTR_exec(vm);
+    // nothing to execute until a key is pressed (see CH8_INSTR_Fx0A)
+    if (vm->internal_flags & CH8_VM_WAIT_KEY) {
+        vm->internal_flags |= CH8_VM_IDLE;
+        return CH8_VM_SUCCESS;
+    }
+    vm->internal_flags &= ~CH8_VM_IDLE;
+
+    // instructions at odd addresses are not cached, fetch and decode them every time.
+    // Neither are the last instruction of a budget if the cache may hold (or decoding
+    // it may create) a superinstruction.
+    const CH8_INSTR_decoded *op = &vm->decoded[(vm->cpu.pc >> 1u) & 0x07FFu];
+    if ((vm->cpu.pc & (0xF000u | 0x0001u)) ||
+        (max_cycles < 2 && (op->len > 1 || op->handler == CH8_INSTR_decode_miss)))
+    {
+        // fetch the instruction, the program counter wraps around the end of memory
+        vm->current_opcode = vm->mem[vm->cpu.pc & 0x0FFFu] << 8 |
+                             vm->mem[(vm->cpu.pc + 1) & 0x0FFFu];
+        // execute the instruction, faulting like the cached CH8_INSTR_unsupported
+        rc = CH8_INSTR_exec(vm);
+        if (rc != CH8_VM_SUCCESS)
+            vm->internal_flags |= CH8_VM_FAULT;
+        // increment the program counter to get next instruction
+        vm->cpu.pc += 2;
+        vm->cycles++;
+        return rc;
+    }
+
+    // execute the cached instruction, decoding it first if needed
+    vm->current_opcode = op->opcode;
+    op->handler(vm, op);
     // increment the program counter to get next instruction
-    vm->cpu->pc += 2;
-    return rc;
+    vm->cpu.pc += 2;
+    vm->cycles += op->len; // superinstructions execute two instructions at once
+
+    return vm->internal_flags & CH8_VM_FAULT ? CH8_VM_UNSUPPORTED_OPCODE : CH8_VM_SUCCESS;
 }
 
 
-//> Sets keypad buffer according to current keyboard state and returns event codes if
-//  special keys have been pressed.
+//> Emulates a single CPU cycle, i.e. executes exactly one instruction. Instructions
+//  the cache has fused into a superinstruction are executed one by one here, so hosts
+//  stepping through a rom see every instruction; CH8_VM_run executes them at once.
 int
-CH8_VM_SDL_set_keys(CH8_VM *vm)
+CH8_VM_emulate_cycle(CH8_VM *vm)
 {
-    SDL_Event e;
-
-    while (SDL_PollEvent(&e)) {
-        if (e.type == SDL_QUIT)
-            return CH8_VM_QUIT;
-
-        // process keydown events
-        if (e.type == SDL_KEYDOWN)
-        {
-            if (e.key.keysym.sym == SDLK_ESCAPE)
-                return CH8_VM_QUIT;
+    return step(vm, 1);
+}
 
-            if (e.key.keysym.sym == SDLK_F1)
-                return CH8_VM_RELOAD;
 
-            if (e.key.keysym.sym == SDLK_F2)
-                return CH8_VM_CPU_DUMP;
+//> Runs the vm for n_cycles instructions, executing translated blocks instead of
+//  single instructions if the CH8_VM_BLOCK_ENGINE or CH8_VM_JIT_ENGINE option is set.
+//  Every engine executes exactly n_cycles instructions: superinstructions and blocks
+//  that don't fit into the rest of the budget are executed instruction by instruction.
+//  Returns early once the rom waits in an idle loop (see CH8_VM_is_idle), and right
+//  away while it waits for a key press.
+int
+CH8_VM_run(CH8_VM *vm, uint64_t n_cycles)
+{
+    if (vm->internal_flags & CH8_VM_WAIT_KEY) {
+        vm->internal_flags |= CH8_VM_IDLE;
+        return CH8_VM_SUCCESS;
+    }
 
-            for (int i = 0; i < 16; ++i) // todo: sizeof(keypad)
-                if (e.key.keysym.sym == keymap[i])
-                    vm->keypad[i] = 1u; // set key states
-        }
+    if (vm->opt_flags & (CH8_VM_BLOCK_ENGINE | CH8_VM_JIT_ENGINE))
+        return CH8_BLOCK_run(vm, n_cycles);
 
-        // process keyup events
-        if (e.type == SDL_KEYUP)
-        {
-            for (int i = 0; i < 16; ++i)
-                if (e.key.keysym.sym == keymap[i])
-                    vm->keypad[i] = 0u; // unset key states
-        }
+    uint64_t end = vm->cycles + n_cycles;
+    while (vm->cycles < end) {
+        int rc = step(vm, end - vm->cycles);
+        if (rc != CH8_VM_SUCCESS)
+            return rc;
+        if (vm->internal_flags & CH8_VM_IDLE)
+            break;
     }
     return CH8_VM_SUCCESS;
 }
+
+
+//> Runs the vm for one 60 Hz frame of cycles_per_frame instructions, then decrements
+//  the timers. Once the rom waits in an idle loop, the rest of the frame is skipped,
+//  as the loop can't be left before the timers are decremented or a key is pressed.
+//  Skipped instructions are counted in vm->skipped_cycles.
+int
+CH8_VM_run_frame(CH8_VM *vm, uint64_t cycles_per_frame)
+{
+    uint64_t start = vm->cycles;
+    int rc = CH8_VM_run(vm, cycles_per_frame);
+
+    if (rc == CH8_VM_SUCCESS && vm->cycles - start < cycles_per_frame)
+        vm->skipped_cycles += cycles_per_frame - (vm->cycles - start);
+
+    CH8_VM_decrement_timers(vm);
+    return rc;
+}
@@ -37,7 +37,9 @@ typedef enum {
     CH8_VM_SCR_H        = 32,
     CH8_VM_FONTSET_SIZE = 80,
     CH8_VM_MEM_SIZE     = 4096, // 0xFFF
-    CH8_VM_MAX_PROGSIZE = 4096 - 512
+    CH8_VM_MAX_PROGSIZE = 4096 - 512,
+    CH8_VM_ALIGN        = 64,  // alignment of vms, one cache line
+    CH8_VM_STATE_MAX_SIZE = 8192 // bytes of a save state at most (see CH8_VM_save_state)
 } CH8_VM_sys_constants;
 
 
@@ -52,12 +54,21 @@ typedef enum {
 typedef enum {
     CH8_VM_NO_OPTS = 1u << 0u,
     CH8_VM_VERBOSE_MODE = 1u << 1u,
-    CH8_VM_ORIGINAL_IMPL = 1u << 2u
+    CH8_VM_ORIGINAL_IMPL = 1u << 2u,
+    CH8_VM_BLOCK_ENGINE = 1u << 3u,
+    CH8_VM_JIT_ENGINE = 1u << 4u,  // block engine compiling hot blocks to native code
+    CH8_VM_NO_FUSION = 1u << 5u    // don't fuse adjacent instructions into superinstructions
 } CH8_VM_opt_flags;
 
 
 typedef enum {
-    CH8_VM_SCREEN_UPDATE = 1u << 0u
+    CH8_VM_SCREEN_UPDATE = 1u << 0u,
+    CH8_VM_FAULT         = 1u << 1u, // an unsupported opcode has been executed
+    CH8_VM_CODE_MODIFIED = 1u << 2u, // translated code has been overwritten
+    CH8_VM_AOT_STALE     = 1u << 3u, // code translated ahead of time has been overwritten
+    CH8_VM_IDLE          = 1u << 4u, // the rom waits for the next timer tick or a key press
+    CH8_VM_WAIT_KEY      = 1u << 5u, // Fx0A waits for a key press, nothing is executed
+    CH8_VM_AUDIO_PATTERN = 1u << 6u  // F002 loaded an audio pattern, which replaces the beep
 } CH8_VM_internal_flags;
 
 typedef enum {
@@ -67,7 +78,8 @@ typedef enum {
     CH8_VM_UNSUPPORTED_OPCODE,
     CH8_VM_ROM_NOTFOUND,
     CH8_VM_ROMSIZE_OUTOFBOUNDS,
-    CH8_VM_CPU_DUMP
+    CH8_VM_CPU_DUMP,
+    CH8_VM_STATE_INVALID // a save state is corrupt, of another version or of another rom
 } CH8_VM_return_codes;
 
 
@@ -90,40 +102,138 @@ typedef struct CH8_CPU {
 
     // The stack is 16 byte wide and is used to store return addresses when
     //subroutines are called. */
+    // The stack pointer wraps around after 16 nested calls.
     reg8_t  sp;
     uint16_t stack[16];
 } CH8_CPU;
 
 
-typedef struct CH8_VM {
-    CH8_CPU *cpu;
+// State of the xoshiro128** generator instruction Cxkk draws random numbers from.
+// Every vm owns one, so a run is reproducible from its seed and vms running on
+// different threads don't share any state (see CH8_VM_seed).
+typedef struct CH8_VM_rng {
+    uint32_t s[4];
+} CH8_VM_rng;
 
-    uint8_t  mem[CH8_VM_MEM_SIZE];
-    uint32_t framebuffer[CH8_VM_SCR_W * CH8_VM_SCR_H]; // for convenience with SDL textures,
-                                                       // framebuffer pixels are 32-bit wide
-    uint8_t keypad[16]; // state of 16-key hexadecimal keypad
 
+struct CH8_VM;
+struct CH8_INSTR_decoded;
+struct CH8_BLOCK_cache;
+
+// Implementation of a single opcode (see instructions.h). Operands are passed
+// already extracted from the opcode.
+typedef void (*CH8_INSTR_handler)(struct CH8_VM *vm, const struct CH8_INSTR_decoded *op);
+
+typedef struct CH8_INSTR_decoded {
+    CH8_INSTR_handler handler;
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t  x;
+    uint8_t  y;
+    unsigned int n   : 4;
+    unsigned int len : 4; // number of instructions executed by the handler, 2 for
+                          // superinstructions (see CH8_INSTR_fuse)
+    uint8_t  kk;
+} CH8_INSTR_decoded;
+
+
+// The whole state of a vm is a single block, so vms can live in storage of the caller,
+// e.g. an array of many vms (see CH8_VM_init_at). State accessed by almost every
+// instruction comes first and fills the first cache line, the memory follows and the
+// display comes last. The rom image is only read by save states.
+typedef struct CH8_VM {
+    CH8_CPU  cpu;
     uint16_t current_opcode;
+    uint32_t internal_flags;
 
+    uint64_t cycles;         // number of instructions executed
+    uint64_t skipped_cycles; // number of instructions skipped while the rom was idle
     uint32_t opt_flags;
-    uint32_t internal_flags;
-} CH8_VM;
+
+    uint8_t keypad[16]; // state of 16-key hexadecimal keypad
+    CH8_VM_rng rng;     // random numbers of Cxkk, kept by CH8_VM_reset
+
+    // XO-CHIP sound: 128 1-bit samples loaded by F002, played while the sound timer
+    // runs at 4000 * 2^((pitch - 64) / 48) samples per second, set by Fx3A
+    uint8_t audio_pattern[16];
+    uint8_t pitch;
+
+    // Translated basic blocks, allocated on first use of the block engine
+    struct CH8_BLOCK_cache *blocks;
+
+    uint8_t  mem[CH8_VM_MEM_SIZE];
+
+    // Decoded instruction cache holding one entry per even address. Entries that
+    // have not been decoded yet (or whose memory has been written to since) hold the
+    // CH8_INSTR_decode_miss handler.
+    CH8_INSTR_decoded decoded[CH8_VM_MEM_SIZE / 2];
+
+    // rom as last loaded, memory of save states is stored as the difference to it
+    uint8_t  rom[CH8_VM_MAX_PROGSIZE];
+    uint16_t rom_size;
+
+    uint32_t dirty_rows;            // rows written since the display was last presented,
+                                    // bit i for row i (see CH8_VM_changed_rows)
+    uint64_t display[CH8_VM_SCR_H]; // one bit per pixel, one word per row. The most
+                                    // significant bit is the leftmost pixel.
+} __attribute__((aligned(CH8_VM_ALIGN))) CH8_VM;
 
 
 CH8_VM *CH8_VM_init(uint32_t opt_flags);
 
+void    CH8_VM_init_at(CH8_VM *vm, uint32_t opt_flags);
+
+void    CH8_VM_release(CH8_VM *vm);
+
+void    CH8_VM_reset(CH8_VM *vm, uint32_t opt_flags);
+
 void    CH8_VM_kill(CH8_VM *vm);
 
 int     CH8_VM_load_rom(CH8_VM *vm, const char *fpath);
 
+int     CH8_VM_load_rom_buffer(CH8_VM *vm, const uint8_t *rom, size_t size);
+
+uint64_t CH8_VM_state_hash(const CH8_VM *vm);
+
+size_t  CH8_VM_save_state(const CH8_VM *vm, uint8_t *buffer, size_t size);
+
+int     CH8_VM_load_state(CH8_VM *vm, const uint8_t *buffer, size_t size);
+
+void    CH8_VM_seed(CH8_VM *vm, uint64_t seed);
+
+uint32_t CH8_VM_random(CH8_VM *vm);
+
 int     CH8_VM_is_drawflag_set(CH8_VM *vm);
 
 void    CH8_VM_unset_drawflag(CH8_VM *vm);
 
+uint32_t CH8_VM_changed_rows(CH8_VM *vm, uint64_t *shown);
+
+void    CH8_VM_expand_rows(const uint64_t *display, const uint64_t *previous, int row, int n_rows,
+                           uint32_t *pixels, const uint32_t palette[4]);
+
+const uint64_t *CH8_VM_get_display(const CH8_VM *vm);
+
+int     CH8_VM_get_pixel(const CH8_VM *vm, uint8_t x, uint8_t y);
+
+int     CH8_VM_is_sound_on(const CH8_VM *vm);
+
+int     CH8_VM_is_idle(CH8_VM *vm);
+
+int     CH8_VM_is_waiting_for_key(CH8_VM *vm);
+
+void    CH8_VM_set_key(CH8_VM *vm, uint8_t key, int pressed);
+
+void    CH8_VM_set_keypad(CH8_VM *vm, uint16_t held, uint16_t tapped);
+
 void    CH8_VM_decrement_timers(CH8_VM *vm);
 
+void    CH8_VM_invalidate(CH8_VM *vm, uint16_t addr, uint16_t len);
+
 int     CH8_VM_emulate_cycle(CH8_VM *vm);
 
-int     CH8_VM_SDL_set_keys(CH8_VM *vm);
+int     CH8_VM_run(CH8_VM *vm, uint64_t n_cycles);
+
+int     CH8_VM_run_frame(CH8_VM *vm, uint64_t cycles_per_frame);
 
 #endif //CATASTROPHIC_CH8_VM_H
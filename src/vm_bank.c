@@ -0,0 +1,699 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include "vm_bank.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "instructions.h"
+
+#include "../rf/mystdlib.h"
+
+
+// Groups spanning more than this many lanes per lane in the group are executed lane
+// by lane
+#define CH8_VM_BANK_MIN_DENSITY 4
+
+// Lanes track the memory they wrote to in chunks of this many bytes, 64 chunks in all
+#define CH8_VM_BANK_CHUNK (CH8_VM_MEM_SIZE / 64)
+
+// Selects new in lanes whose mask m is 0xFF and keeps old in the others
+#define BLEND8(old, new, m)  ((uint8_t)(((old) & ~(m)) | ((new) & (m))))
+#define BLEND16(old, new, m) ((uint16_t)(((old) & ~MASK16(m)) | ((new) & MASK16(m))))
+#define MASK16(m)            ((uint16_t)(int8_t)(m))
+
+
+CH8_VM_bank *
+CH8_VM_bank_create(size_t n_lanes, uint32_t opt_flags)
+{
+    CH8_VM_bank *bank = calloc(1, sizeof(CH8_VM_bank)); NP_CHECK(bank)
+
+    size_t n = (n_lanes + CH8_VM_BANK_LANE_ALIGN - 1) / CH8_VM_BANK_LANE_ALIGN *
+               CH8_VM_BANK_LANE_ALIGN;
+    if (n == 0)
+        n = CH8_VM_BANK_LANE_ALIGN;
+
+    bank->n_lanes  = n_lanes;
+    bank->n_padded = n;
+
+    // wider arrays first, so every array starts aligned
+    uint8_t *p = bank->storage = calloc(n, sizeof(uint64_t) + sizeof(uint32_t) +
+                                           4 * sizeof(uint16_t) + 16 + 4);
+    NP_CHECK(bank->storage)
+
+    bank->written = (uint64_t *) p; p += n * sizeof(uint64_t);
+    bank->lanes  = (uint32_t *) p; p += n * sizeof(uint32_t);
+    bank->keys   = (uint16_t *) p; p += n * sizeof(uint16_t);
+    bank->I      = (uint16_t *) p; p += n * sizeof(uint16_t);
+    bank->pc     = (uint16_t *) p; p += n * sizeof(uint16_t);
+    bank->opcode = (uint16_t *) p; p += n * sizeof(uint16_t);
+    for (int x = 0; x < 16; x++) {
+        bank->V[x] = p; p += n;
+    }
+    bank->delay_timer = p; p += n;
+    bank->sound_timer = p; p += n;
+    bank->active      = p; p += n;
+    bank->group       = p;
+
+    // the vms of all lanes are a single array
+    void *vms = NULL;
+    if (posix_memalign(&vms, CH8_VM_ALIGN, n_lanes * sizeof(CH8_VM)) != 0)
+        vms = NULL;
+    NP_CHECK(vms)
+
+    bank->vms = vms;
+    for (size_t i = 0; i < n_lanes; i++) {
+        CH8_VM_init_at(&bank->vms[i], opt_flags);
+        CH8_VM_bank_update_lane(bank, i);
+    }
+    return bank;
+}
+
+
+void
+CH8_VM_bank_destroy(CH8_VM_bank *bank)
+{
+    if (bank == NULL)
+        return;
+    for (size_t i = 0; i < bank->n_lanes; i++)
+        CH8_VM_release(&bank->vms[i]);
+    free(bank->vms);
+    free(bank->storage);
+    free(bank);
+}
+
+
+//> Copies the registers of a lane from the bank to its vm.
+static void
+store_lane(CH8_VM_bank *bank, size_t lane)
+{
+    CH8_CPU *cpu = &bank->vms[lane].cpu;
+
+    for (int x = 0; x < 16; x++)
+        cpu->V[x] = bank->V[x][lane];
+    cpu->I  = bank->I[lane];
+    cpu->pc = bank->pc[lane];
+    cpu->delay_timer = bank->delay_timer[lane];
+    cpu->sound_timer = bank->sound_timer[lane];
+}
+
+
+//> Copies the registers of a lane from its vm to the bank.
+static void
+load_lane(CH8_VM_bank *bank, size_t lane)
+{
+    const CH8_CPU *cpu = &bank->vms[lane].cpu;
+
+    for (int x = 0; x < 16; x++)
+        bank->V[x][lane] = cpu->V[x];
+    bank->I[lane]  = cpu->I;
+    bank->pc[lane] = cpu->pc;
+    bank->delay_timer[lane] = cpu->delay_timer;
+    bank->sound_timer[lane] = cpu->sound_timer;
+}
+
+
+//> Resets all lanes and loads a rom of size bytes from memory into each of them.
+int
+CH8_VM_bank_load_rom_buffer(CH8_VM_bank *bank, const uint8_t *rom, size_t size)
+{
+    for (size_t i = 0; i < bank->n_lanes; i++) {
+        CH8_VM *vm = &bank->vms[i];
+        CH8_VM_reset(vm, vm->opt_flags);
+
+        int rc = CH8_VM_load_rom_buffer(vm, rom, size);
+        if (rc != CH8_VM_SUCCESS)
+            return rc;
+        CH8_VM_bank_update_lane(bank, i);
+    }
+
+    // lanes fetch from the same image until they write to their memory
+    if (bank->n_lanes > 0)
+        memcpy(bank->code, bank->vms[0].mem, sizeof(bank->code));
+    memset(bank->written, 0x00, bank->n_padded * sizeof(uint64_t));
+
+    bank->cycles        = 0;
+    bank->batched_lanes = 0;
+    bank->handler_lanes = 0;
+    return CH8_VM_SUCCESS;
+}
+
+
+//> Returns the vm of a lane, e.g. to read its display, with its registers brought up
+//  to date with the bank. Lanes draw random numbers from the generator of their vm, so
+//  they can be seeded with CH8_VM_seed at any time.
+CH8_VM *
+CH8_VM_bank_lane(CH8_VM_bank *bank, size_t lane)
+{
+    store_lane(bank, lane);
+    return &bank->vms[lane];
+}
+
+
+//> Takes over the registers, memory and keypad of a lane from its vm after the host
+//  changed them, e.g. by resetting the vm and loading a rom into it. A faulted lane
+//  executes again.
+void
+CH8_VM_bank_update_lane(CH8_VM_bank *bank, size_t lane)
+{
+    CH8_VM *vm = &bank->vms[lane];
+
+    load_lane(bank, lane);
+    bank->written[lane] = ~0ull;
+
+    bank->keys[lane] = 0;
+    for (int key = 0; key < 16; key++)
+        bank->keys[lane] |= (uint16_t)((vm->keypad[key] != 0) << key);
+
+    vm->internal_flags &= ~CH8_VM_FAULT;
+    bank->active[lane] = 0xFF;
+}
+
+
+//> Returns whether a lane stopped at an unsupported opcode.
+int
+CH8_VM_bank_is_faulted(const CH8_VM_bank *bank, size_t lane)
+{
+    return bank->active[lane] == 0;
+}
+
+
+void
+CH8_VM_bank_set_key(CH8_VM_bank *bank, size_t lane, uint8_t key, int pressed)
+{
+    uint16_t bit = (uint16_t)(1u << (key & 0x0Fu));
+
+    bank->keys[lane] = pressed ? bank->keys[lane] | bit : bank->keys[lane] & ~bit;
+    CH8_VM_set_key(&bank->vms[lane], key, pressed);
+}
+
+
+//> Decrements the timers of all lanes if they are set.
+void
+CH8_VM_bank_decrement_timers(CH8_VM_bank *bank)
+{
+    uint8_t *dt = bank->delay_timer;
+    uint8_t *st = bank->sound_timer;
+
+    for (size_t i = 0; i < bank->n_padded; i++) {
+        dt[i] -= dt[i] != 0;
+        st[i] -= st[i] != 0;
+    }
+}
+
+
+//> Returns whether all lanes executing fetched the same opcode from the same address,
+//  so the step can be executed by one loop over all lanes.
+static int
+is_converged(const CH8_VM_bank *bank)
+{
+    const uint16_t pc     = bank->pc[0];
+    const uint16_t opcode = bank->opcode[0];
+
+    // lanes not executing are ignored
+#if defined(__AVX2__)
+    const __m256i want_pc     = _mm256_set1_epi16((short) pc);
+    const __m256i want_opcode = _mm256_set1_epi16((short) opcode);
+    for (size_t i = 0; i < bank->n_padded; i += 32) {
+        __m256i lo = _mm256_and_si256(
+                _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) &bank->pc[i]), want_pc),
+                _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) &bank->opcode[i]), want_opcode));
+        __m256i hi = _mm256_and_si256(
+                _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) &bank->pc[i + 16]), want_pc),
+                _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *) &bank->opcode[i + 16]), want_opcode));
+
+        // packing works within 128-bit halves, which doesn't matter for the whole mask
+        __m256i same = _mm256_packs_epi16(lo, hi);
+        __m256i idle = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) &bank->active[i]),
+                                         _mm256_setzero_si256());
+        if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_permute4x64_epi64(same, 0xD8), idle)) != -1)
+            return 0;
+    }
+#elif defined(__SSE2__)
+    const __m128i want_pc     = _mm_set1_epi16((short) pc);
+    const __m128i want_opcode = _mm_set1_epi16((short) opcode);
+    for (size_t i = 0; i < bank->n_padded; i += 16) {
+        __m128i lo = _mm_and_si128(
+                _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) &bank->pc[i]), want_pc),
+                _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) &bank->opcode[i]), want_opcode));
+        __m128i hi = _mm_and_si128(
+                _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) &bank->pc[i + 8]), want_pc),
+                _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *) &bank->opcode[i + 8]), want_opcode));
+
+        __m128i same = _mm_packs_epi16(lo, hi);
+        __m128i idle = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) &bank->active[i]),
+                                      _mm_setzero_si128());
+        if (_mm_movemask_epi8(_mm_or_si128(same, idle)) != 0xFFFF)
+            return 0;
+    }
+#else
+    for (size_t i = 0; i < bank->n_lanes; i++)
+        if (bank->active[i] && (bank->pc[i] != pc || bank->opcode[i] != opcode))
+            return 0;
+#endif
+    return bank->active[0] != 0;
+}
+
+
+// Instructions executed by loops over the registers of the lanes (see exec_kernel)
+typedef enum {
+    KERNEL_NONE = 0, // executed by the handler of each lane
+    KERNEL_1nnn, KERNEL_Bnnn, KERNEL_2nnn, KERNEL_00EE,
+    KERNEL_3xkk, KERNEL_4xkk, KERNEL_5xy0, KERNEL_9xy0,
+    KERNEL_6xkk, KERNEL_7xkk,
+    KERNEL_8xy0, KERNEL_8xy1, KERNEL_8xy2, KERNEL_8xy3, KERNEL_8xy4,
+    KERNEL_8xy5, KERNEL_8xy6, KERNEL_8xy7, KERNEL_8xyE,
+    KERNEL_Annn, KERNEL_Fx07, KERNEL_Fx15, KERNEL_Fx18, KERNEL_Fx1E, KERNEL_Fx29,
+    KERNEL_Ex9E, KERNEL_ExA1, KERNEL_Fx0A
+} bank_kernel;
+
+static const struct {
+    CH8_INSTR_handler handler;
+    bank_kernel       kernel;
+} kernels[] = {
+        {CH8_INSTR_1nnn, KERNEL_1nnn}, {CH8_INSTR_Bnnn, KERNEL_Bnnn},
+        {CH8_INSTR_2nnn, KERNEL_2nnn}, {CH8_INSTR_00EE, KERNEL_00EE},
+        {CH8_INSTR_3xkk, KERNEL_3xkk}, {CH8_INSTR_4xkk, KERNEL_4xkk},
+        {CH8_INSTR_5xy0, KERNEL_5xy0}, {CH8_INSTR_9xy0, KERNEL_9xy0},
+        {CH8_INSTR_6xkk, KERNEL_6xkk}, {CH8_INSTR_7xkk, KERNEL_7xkk},
+        {CH8_INSTR_8xy0, KERNEL_8xy0}, {CH8_INSTR_8xy1, KERNEL_8xy1},
+        {CH8_INSTR_8xy2, KERNEL_8xy2}, {CH8_INSTR_8xy3, KERNEL_8xy3},
+        {CH8_INSTR_8xy4, KERNEL_8xy4}, {CH8_INSTR_8xy5, KERNEL_8xy5},
+        {CH8_INSTR_8xy6, KERNEL_8xy6}, {CH8_INSTR_8xy7, KERNEL_8xy7},
+        {CH8_INSTR_8xyE, KERNEL_8xyE}, {CH8_INSTR_Annn, KERNEL_Annn},
+        {CH8_INSTR_Fx07, KERNEL_Fx07}, {CH8_INSTR_Fx15, KERNEL_Fx15},
+        {CH8_INSTR_Fx18, KERNEL_Fx18}, {CH8_INSTR_Fx1E, KERNEL_Fx1E},
+        {CH8_INSTR_Fx29, KERNEL_Fx29}, {CH8_INSTR_Ex9E, KERNEL_Ex9E},
+        {CH8_INSTR_ExA1, KERNEL_ExA1}, {CH8_INSTR_Fx0A, KERNEL_Fx0A},
+};
+
+
+static bank_kernel
+kernel_of(CH8_INSTR_handler handler)
+{
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+        if (kernels[k].handler == handler)
+            return kernels[k].kernel;
+    return KERNEL_NONE;
+}
+
+
+//> Executes an instruction in the lanes of bank->group between first and end without
+//  copying registers to the vms of the lanes. Instructions on registers only are
+//  loops over the registers of all lanes in that range, blending the results of the
+//  group into them. Each loop performs the register accesses of the handler in the
+//  same order, so aliasing registers (like Vx being VF) give the same results.
+static void
+exec_kernel(CH8_VM_bank *bank, bank_kernel k, const CH8_INSTR_decoded *op, size_t first, size_t end)
+{
+    const uint8_t  kk  = op->kk;
+    const uint16_t nnn = op->nnn;
+
+    const uint8_t *g = bank->group;
+    uint8_t  *vx = bank->V[op->x];
+    uint8_t  *vy = bank->V[op->y];
+    uint8_t  *v0 = bank->V[0x0];
+    uint8_t  *vf = bank->V[0xF];
+    uint16_t *I  = bank->I;
+    uint16_t *pc = bank->pc;
+    uint8_t  *dt = bank->delay_timer;
+    uint8_t  *st = bank->sound_timer;
+    uint16_t *keys = bank->keys;
+
+#define CH8_VM_BANK_LANES(i) for (size_t i = first; i < end; i++)
+
+    switch (k)
+    {
+        case KERNEL_1nnn:
+            CH8_VM_BANK_LANES(i) pc[i] = BLEND16(pc[i], nnn - 2, g[i]);
+            break;
+        case KERNEL_Bnnn:
+            CH8_VM_BANK_LANES(i) pc[i] = BLEND16(pc[i], nnn + v0[i], g[i]);
+            break;
+
+        case KERNEL_3xkk:
+            CH8_VM_BANK_LANES(i) pc[i] += g[i] & (vx[i] == kk ? 2u : 0u);
+            break;
+        case KERNEL_4xkk:
+            CH8_VM_BANK_LANES(i) pc[i] += g[i] & (vx[i] != kk ? 2u : 0u);
+            break;
+        case KERNEL_5xy0:
+            CH8_VM_BANK_LANES(i) pc[i] += g[i] & (vx[i] == vy[i] ? 2u : 0u);
+            break;
+        case KERNEL_9xy0:
+            CH8_VM_BANK_LANES(i) pc[i] += g[i] & (vx[i] != vy[i] ? 2u : 0u);
+            break;
+
+        case KERNEL_6xkk:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], kk, g[i]);
+            break;
+        case KERNEL_7xkk:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], vx[i] + kk, g[i]);
+            break;
+
+        case KERNEL_8xy0:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], vy[i], g[i]);
+            break;
+        case KERNEL_8xy1:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], vx[i] | vy[i], g[i]);
+            break;
+        case KERNEL_8xy2:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], vx[i] & vy[i], g[i]);
+            break;
+        case KERNEL_8xy3:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], vx[i] ^ vy[i], g[i]);
+            break;
+        case KERNEL_8xy4:
+            CH8_VM_BANK_LANES(i) {
+                unsigned int r = vx[i] + vy[i];
+                vf[i] = BLEND8(vf[i], r >> 8u, g[i]);
+                vx[i] = BLEND8(vx[i], r, g[i]);
+            }
+            break;
+        case KERNEL_8xy5:
+            CH8_VM_BANK_LANES(i) {
+                vf[i] = BLEND8(vf[i], vx[i] >= vy[i], g[i]);
+                vx[i] = BLEND8(vx[i], vx[i] - vy[i], g[i]);
+            }
+            break;
+        case KERNEL_8xy6:
+            CH8_VM_BANK_LANES(i) {
+                vf[i] = BLEND8(vf[i], vx[i] & 0x01u, g[i]);
+                vx[i] = BLEND8(vx[i], vx[i] >> 1u, g[i]);
+            }
+            break;
+        case KERNEL_8xy7:
+            CH8_VM_BANK_LANES(i) {
+                vf[i] = BLEND8(vf[i], vy[i] >= vx[i], g[i]);
+                vx[i] = BLEND8(vx[i], vy[i] - vx[i], g[i]);
+            }
+            break;
+        case KERNEL_8xyE:
+            CH8_VM_BANK_LANES(i) {
+                vf[i] = BLEND8(vf[i], vx[i] >> 7u, g[i]);
+                vx[i] = BLEND8(vx[i], vx[i] << 1u, g[i]);
+            }
+            break;
+
+        case KERNEL_Annn:
+            CH8_VM_BANK_LANES(i) I[i] = BLEND16(I[i], nnn, g[i]);
+            break;
+        case KERNEL_Fx07:
+            CH8_VM_BANK_LANES(i) vx[i] = BLEND8(vx[i], dt[i], g[i]);
+            break;
+        case KERNEL_Fx15:
+            CH8_VM_BANK_LANES(i) dt[i] = BLEND8(dt[i], vx[i], g[i]);
+            break;
+        case KERNEL_Fx18:
+            CH8_VM_BANK_LANES(i) st[i] = BLEND8(st[i], vx[i], g[i]);
+            break;
+        case KERNEL_Fx1E:
+            CH8_VM_BANK_LANES(i) {
+                vf[i] = BLEND8(vf[i], I[i] + vx[i] > 0x0FFF, g[i]);
+                I[i]  = BLEND16(I[i], I[i] + vx[i], g[i]);
+            }
+            break;
+        case KERNEL_Fx29:
+            CH8_VM_BANK_LANES(i) I[i] = BLEND16(I[i], CH8_VM_FONTSET_START_ADDR + vx[i] * 5, g[i]);
+            break;
+
+        // the stack of the lanes stays in their vms
+        case KERNEL_2nnn:
+            CH8_VM_BANK_LANES(i) if (g[i]) {
+                CH8_CPU *cpu = &bank->vms[i].cpu;
+                cpu->stack[cpu->sp & 0x0Fu] = pc[i];
+                cpu->sp = (cpu->sp + 1u) & 0x0Fu;
+                pc[i] = nnn - 2;
+            }
+            break;
+        case KERNEL_00EE:
+            CH8_VM_BANK_LANES(i) if (g[i]) {
+                CH8_CPU *cpu = &bank->vms[i].cpu;
+                cpu->sp = (cpu->sp - 1u) & 0x0Fu;
+                pc[i] = cpu->stack[cpu->sp];
+            }
+            break;
+        // only the low nibble of Vx selects the key, like in the interpreter
+        case KERNEL_Ex9E:
+            CH8_VM_BANK_LANES(i) if (g[i] && (keys[i] >> (vx[i] & 0x0Fu)) & 1u)
+                pc[i] += 2;
+            break;
+        case KERNEL_ExA1:
+            CH8_VM_BANK_LANES(i) if (g[i] && !((keys[i] >> (vx[i] & 0x0Fu)) & 1u))
+                pc[i] += 2;
+            break;
+        case KERNEL_Fx0A:
+            CH8_VM_BANK_LANES(i) if (g[i]) {
+                if (keys[i])
+                    vx[i] = (uint8_t) __builtin_ctz(keys[i]);
+                else
+                    pc[i] -= 2;
+            }
+            break;
+
+        case KERNEL_NONE:
+            break;
+    }
+
+#undef CH8_VM_BANK_LANES
+}
+
+
+//> Marks the memory range [addr, addr + len) of a lane as written, so the lane fetches
+//  instructions from there from its own memory instead of the image of the rom.
+static void
+mark_written(CH8_VM_bank *bank, size_t lane, uint32_t addr, uint32_t len)
+{
+    // the range wraps around the end of memory like the stores do
+    for (uint32_t a = addr; a < addr + len; a++)
+        bank->written[lane] |= 1ull << ((a & 0x0FFFu) / CH8_VM_BANK_CHUNK);
+}
+
+
+//> Executes an instruction in a single lane with its handler. Returns whether the
+//  lane faulted.
+static int
+exec_lane(CH8_VM_bank *bank, size_t lane, const CH8_INSTR_decoded *op)
+{
+    CH8_VM *vm = &bank->vms[lane];
+
+    if (op->handler == CH8_INSTR_Fx33 || op->handler == CH8_INSTR_Fx55)
+        mark_written(bank, lane, bank->I[lane], op->handler == CH8_INSTR_Fx33 ? 3 : op->x + 1);
+
+    store_lane(bank, lane);
+    vm->current_opcode = op->opcode;
+    op->handler(vm, op);
+    load_lane(bank, lane);
+
+    if (vm->internal_flags & CH8_VM_FAULT) {
+        bank->active[lane] = 0x00;
+        bank->pc[lane] += 2; // like CH8_VM_emulate_cycle, past the faulting instruction
+        return 1;
+    }
+    return 0;
+}
+
+
+//> Executes the instruction of the first of n lanes in all of them, which fetched it
+//  from the same address. Lanes that fetched another opcode, after overwriting their
+//  code, are executed one by one. Returns whether a lane faulted.
+static int
+exec_group(CH8_VM_bank *bank, uint32_t *lanes, size_t n)
+{
+    const uint16_t pc     = bank->pc[lanes[0]];
+    const uint16_t opcode = bank->opcode[lanes[0]];
+    CH8_INSTR_decoded op;
+    int faulted = 0;
+
+    size_t n_group = 0;
+    for (size_t k = 0; k < n; k++) {
+        uint32_t i = lanes[k];
+        if (bank->pc[i] == pc && bank->opcode[i] == opcode) {
+            lanes[n_group++] = i;
+        } else {
+            CH8_INSTR_decode(bank->opcode[i], &op);
+            faulted |= exec_lane(bank, i, &op);
+            bank->handler_lanes++;
+        }
+    }
+
+    CH8_INSTR_decode(opcode, &op);
+    bank_kernel k = kernel_of(op.handler);
+
+    if (k == KERNEL_NONE) {
+        for (size_t m = 0; m < n_group; m++)
+            faulted |= exec_lane(bank, lanes[m], &op);
+        bank->handler_lanes += n_group;
+        return faulted;
+    }
+
+    for (size_t m = 0; m < n_group; m++)
+        bank->group[lanes[m]] = 0xFF;
+
+    // a loop over all lanes the group spans only pays off if most of them are in the
+    // group, sparse groups are executed lane by lane
+    size_t first = lanes[0];
+    size_t end   = lanes[n_group - 1] + 1;
+    if (n_group * CH8_VM_BANK_MIN_DENSITY >= end - first)
+        exec_kernel(bank, k, &op, first, end);
+    else
+        for (size_t m = 0; m < n_group; m++)
+            exec_kernel(bank, k, &op, lanes[m], lanes[m] + 1);
+
+    for (size_t m = 0; m < n_group; m++)
+        bank->group[lanes[m]] = 0x00;
+
+    bank->batched_lanes += n_group;
+    return faulted;
+}
+
+
+//> Executes the instruction all lanes fetched from the same address.
+static int
+exec_converged(CH8_VM_bank *bank)
+{
+    CH8_INSTR_decoded op;
+    CH8_INSTR_decode(bank->opcode[0], &op);
+    bank_kernel k = kernel_of(op.handler);
+
+    size_t n = 0;
+    int faulted = 0;
+
+    if (k == KERNEL_NONE) {
+        for (size_t i = 0; i < bank->n_lanes; i++)
+            if (bank->active[i]) {
+                faulted |= exec_lane(bank, i, &op);
+                n++;
+            }
+        bank->handler_lanes += n;
+        return faulted;
+    }
+
+    // the group is every lane executing
+    for (size_t i = 0; i < bank->n_padded; i++)
+        n += bank->active[i] & 1u;
+    memcpy(bank->group, bank->active, bank->n_padded);
+    exec_kernel(bank, k, &op, 0, bank->n_padded);
+    memset(bank->group, 0x00, bank->n_padded);
+
+    bank->batched_lanes += n;
+    return 0;
+}
+
+
+//> Executes one instruction in every lane that hasn't faulted. Returns
+//  CH8_VM_UNSUPPORTED_OPCODE if a lane faulted, the other lanes are unaffected.
+int
+CH8_VM_bank_step(CH8_VM_bank *bank)
+{
+    const size_t n_lanes = bank->n_lanes;
+    uint32_t *lanes = bank->lanes;
+    int faulted = 0;
+
+    for (size_t i = 0; i < n_lanes; i++) {
+        uint16_t pc   = bank->pc[i] & 0x0FFFu;
+        uint16_t next = (pc + 1u) & 0x0FFFu;
+
+        const uint8_t *mem = bank->code;
+        if ((bank->written[i] >> (pc / CH8_VM_BANK_CHUNK) |
+             bank->written[i] >> (next / CH8_VM_BANK_CHUNK)) & 1u)
+            mem = bank->vms[i].mem;
+        bank->opcode[i] = (uint16_t)(mem[pc] << 8u | mem[next]);
+    }
+
+    if (is_converged(bank)) {
+        faulted = exec_converged(bank);
+    } else {
+        // sort the lanes into groups by program counter. Groups are kept in the order
+        // of their first lane, lanes in ascending order within a group.
+        uint32_t *size = bank->group_size;
+        size_t n_groups = 0;
+
+        for (size_t i = 0; i < n_lanes; i++)
+            if (bank->active[i]) {
+                uint16_t g = (bank->pc[i] & 0x0FFFu) >> 1u;
+                if (size[g]++ == 0)
+                    bank->groups[n_groups++] = g;
+            }
+
+        uint32_t offset = 0;
+        for (size_t j = 0; j < n_groups; j++) {
+            uint16_t g = bank->groups[j];
+            uint32_t n = size[g];
+            size[g]  = offset; // start of the group, then its end once filled
+            offset  += n;
+        }
+        for (size_t i = 0; i < n_lanes; i++)
+            if (bank->active[i])
+                lanes[size[(bank->pc[i] & 0x0FFFu) >> 1u]++] = (uint32_t) i;
+
+        uint32_t start = 0;
+        for (size_t j = 0; j < n_groups; j++) {
+            uint16_t g = bank->groups[j];
+            faulted |= exec_group(bank, lanes + start, size[g] - start);
+            start   = size[g];
+            size[g] = 0;
+        }
+    }
+
+    for (size_t i = 0; i < bank->n_padded; i++)
+        bank->pc[i] += bank->active[i] & 2u;
+
+    bank->cycles++;
+    return faulted ? CH8_VM_UNSUPPORTED_OPCODE : CH8_VM_SUCCESS;
+}
+
+
+//> Executes n_cycles instructions in every lane. Returns CH8_VM_UNSUPPORTED_OPCODE if
+//  a lane faulted, the other lanes keep running.
+int
+CH8_VM_bank_run(CH8_VM_bank *bank, uint64_t n_cycles)
+{
+    int rc = CH8_VM_SUCCESS;
+    for (uint64_t i = 0; i < n_cycles; i++)
+        if (CH8_VM_bank_step(bank) != CH8_VM_SUCCESS)
+            rc = CH8_VM_UNSUPPORTED_OPCODE;
+    return rc;
+}
+
+
+//> Runs all lanes for a frame of cycles_per_frame instructions and decrements their
+//  timers afterwards. Unlike CH8_VM_run_frame, lanes never skip idle instructions, so
+//  they stay in lockstep.
+int
+CH8_VM_bank_run_frame(CH8_VM_bank *bank, uint64_t cycles_per_frame)
+{
+    int rc = CH8_VM_bank_run(bank, cycles_per_frame);
+    CH8_VM_bank_decrement_timers(bank);
+    return rc;
+}
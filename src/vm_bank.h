@@ -0,0 +1,103 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#ifndef CATASTROPHIC_CHIP8_VM_BANK_H
+#define CATASTROPHIC_CHIP8_VM_BANK_H
+
+#include "vm.h"
+
+
+// Lanes are allocated in multiples of this, so vector loops never need a remainder
+#define CH8_VM_BANK_LANE_ALIGN 32
+
+
+// Many vms running the same rom in lockstep, e.g. with different inputs. The registers
+// of all lanes are stored as structure of arrays: V[x][i] is register Vx of lane i.
+// Each step, lanes that fetched the same opcode from the same address form a group.
+// Instructions on registers are executed for the whole group by loops over these
+// arrays, which the compiler turns into vector instructions. Instructions touching
+// memory or the display are executed one lane at a time by the handlers of
+// instructions.h.
+typedef struct CH8_VM_bank {
+    size_t n_lanes;
+    size_t n_padded; // n_lanes rounded up to a multiple of CH8_VM_BANK_LANE_ALIGN
+
+    uint8_t  *V[16];
+    uint16_t *I;
+    uint16_t *pc;
+    uint8_t  *delay_timer;
+    uint8_t  *sound_timer;
+
+    uint16_t *keys;    // keys pressed in each lane, bit k for key k
+    uint8_t  *active;  // 0xFF for lanes executing, 0 for faulted lanes and padding
+
+    // Lanes fetch instructions from the image of the rom all of them loaded, except from
+    // memory they have written to since, tracked in 64 chunks per lane.
+    uint8_t   code[CH8_VM_MEM_SIZE];
+    uint64_t *written;
+
+    // scratch of a step
+    uint16_t *opcode;  // opcode fetched by each lane
+    uint8_t  *group;   // 0xFF for lanes in the group executed, 0 for all others
+    uint32_t *lanes;   // lanes sorted by group
+    uint32_t  group_size[CH8_VM_MEM_SIZE / 2]; // lanes per program counter, 0 between steps
+    uint16_t  groups[CH8_VM_MEM_SIZE / 2];     // program counters / 2 of the groups
+
+    // Memory, display, keypad and stack of every lane. The registers of a lane's vm
+    // are only up to date after CH8_VM_bank_lane, changes of the host to a lane's vm
+    // are only seen by the bank after CH8_VM_bank_update_lane.
+    CH8_VM *vms;
+
+    void *storage; // all of the arrays of lanes above
+
+    uint64_t cycles;        // steps executed
+    uint64_t batched_lanes; // lane instructions executed by loops over the lanes
+    uint64_t handler_lanes; // lane instructions executed by their handlers
+} CH8_VM_bank;
+
+
+CH8_VM_bank *CH8_VM_bank_create(size_t n_lanes, uint32_t opt_flags);
+
+void    CH8_VM_bank_destroy(CH8_VM_bank *bank);
+
+int     CH8_VM_bank_load_rom_buffer(CH8_VM_bank *bank, const uint8_t *rom, size_t size);
+
+CH8_VM *CH8_VM_bank_lane(CH8_VM_bank *bank, size_t lane);
+
+void    CH8_VM_bank_update_lane(CH8_VM_bank *bank, size_t lane);
+
+int     CH8_VM_bank_is_faulted(const CH8_VM_bank *bank, size_t lane);
+
+void    CH8_VM_bank_set_key(CH8_VM_bank *bank, size_t lane, uint8_t key, int pressed);
+
+void    CH8_VM_bank_decrement_timers(CH8_VM_bank *bank);
+
+int     CH8_VM_bank_step(CH8_VM_bank *bank);
+
+int     CH8_VM_bank_run(CH8_VM_bank *bank, uint64_t n_cycles);
+
+int     CH8_VM_bank_run_frame(CH8_VM_bank *bank, uint64_t cycles_per_frame);
+
+#endif //CATASTROPHIC_CHIP8_VM_BANK_H
@@ -0,0 +1,101 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+// Runs roms translated ahead of time by catastrophic_chip8_aot (see CMakeLists.txt) and
+// checks that every frame ends in the same state as running the rom with CH8_VM_run,
+// including roms that overwrite their own code or run into an unsupported opcode.
+
+#include <stdio.h>
+
+#include "../src/aot.h"
+
+
+#define CYCLES_PER_FRAME 11 // 700 Hz
+#define FRAMES           3000
+
+
+extern const CH8_AOT_program CH8_AOT_pong;
+extern const CH8_AOT_program CH8_AOT_brix;
+extern const CH8_AOT_program CH8_AOT_invaders;
+extern const CH8_AOT_program CH8_AOT__15puzzle; // overwrites its own code
+extern const CH8_AOT_program CH8_AOT_store_past_end;
+
+static const CH8_AOT_program *programs[] = {
+        &CH8_AOT_pong, &CH8_AOT_brix, &CH8_AOT_invaders,
+        &CH8_AOT__15puzzle, &CH8_AOT_store_past_end
+};
+
+
+//> Returns the first frame after which the translation and the interpreter differ, or
+//  -1 if they agree on all frames.
+static long
+compare(const CH8_AOT_program *program)
+{
+    CH8_VM *aot = CH8_VM_init(CH8_VM_NO_OPTS);
+    CH8_VM *ref = CH8_VM_init(CH8_VM_NO_OPTS);
+    CH8_AOT_load(aot, program);
+    CH8_AOT_load(ref, program);
+
+    long diverged = -1;
+    for (long frame = 0; frame < FRAMES && diverged < 0; frame++)
+    {
+        // presses and releases keys following a fixed script, like the benchmark does
+        uint8_t key = (uint8_t)((frame / 23) % 16);
+        CH8_VM_set_key(aot, key, (frame / 7) % 3 != 0);
+        CH8_VM_set_key(ref, key, (frame / 7) % 3 != 0);
+
+        int rc_aot = program->run(aot, CYCLES_PER_FRAME);
+        int rc_ref = CH8_VM_run(ref, CYCLES_PER_FRAME);
+        CH8_VM_decrement_timers(aot);
+        CH8_VM_decrement_timers(ref);
+
+        if (rc_aot != rc_ref || aot->cycles != ref->cycles ||
+            CH8_VM_state_hash(aot) != CH8_VM_state_hash(ref))
+            diverged = frame;
+        else if (rc_ref != CH8_VM_SUCCESS)
+            break; // engines only agree up to an unsupported opcode
+    }
+
+    CH8_VM_kill(aot);
+    CH8_VM_kill(ref);
+    return diverged;
+}
+
+
+int
+main(void)
+{
+    int failed = 0;
+    for (size_t p = 0; p < sizeof(programs) / sizeof(programs[0]); p++)
+    {
+        long frame = compare(programs[p]);
+        if (frame < 0)
+            printf("%-20s ok\n", programs[p]->name);
+        else
+            printf("%-20s diverged after frame %ld\n", programs[p]->name, frame);
+        failed |= frame >= 0;
+    }
+    return failed;
+}
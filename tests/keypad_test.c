@@ -0,0 +1,82 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+// Checks that the vm sees keys tapped between two frames of the host, as set with
+// CH8_VM_set_keypad, even if they have been released before the frame ran.
+
+#include <stdio.h>
+
+#include "../src/vm.h"
+
+
+#define CHECK(cond)                                                      \
+    if (!(cond)) {                                                       \
+        printf("%s:%d check failed: %s\n", __FILE__, __LINE__, #cond);   \
+        failed = 1;                                                      \
+    }
+
+
+int
+main(void)
+{
+    // F50A waits for a key and stores it in V5, 1202 loops forever after
+    static const uint8_t rom[] = { 0xF5, 0x0A, 0x12, 0x02 };
+    static const uint32_t engines[] = {
+            CH8_VM_NO_OPTS, CH8_VM_BLOCK_ENGINE, CH8_VM_JIT_ENGINE
+    };
+    int failed = 0;
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+    {
+        CH8_VM *vm = CH8_VM_init(engines[e]);
+        CH8_VM_load_rom_buffer(vm, rom, sizeof(rom));
+
+        CH8_VM_set_keypad(vm, 0x0000, 0x0000);
+        CH8_VM_run_frame(vm, 11);
+        CHECK(CH8_VM_is_waiting_for_key(vm))
+
+        // key 7 was pressed and released again since the last frame
+        CH8_VM_set_keypad(vm, 0x0000, 1u << 7u);
+        CH8_VM_run_frame(vm, 11);
+        CHECK(!CH8_VM_is_waiting_for_key(vm))
+        CHECK(vm->cpu.V[5] == 7)
+        CHECK(vm->cpu.pc == 0x202)
+        CHECK(vm->keypad[7])
+
+        // it is released with the next frame, keys held stay pressed
+        CH8_VM_set_keypad(vm, 1u << 3u, 0x0000);
+        CHECK(!vm->keypad[7])
+        CHECK(vm->keypad[3])
+        CH8_VM_set_keypad(vm, 1u << 3u, 1u << 3u);
+        CHECK(vm->keypad[3])
+        CH8_VM_set_keypad(vm, 0x0000, 0x0000);
+        CHECK(!vm->keypad[3])
+
+        printf("options 0x%02X %s\n", (unsigned) engines[e], failed ? "failed" : "ok");
+        CH8_VM_kill(vm);
+    }
+
+    return failed;
+}
@@ -0,0 +1,147 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+// Checks save states on a set of roms: a vm restored from a state has to hash like the
+// vm it was saved from and keep running exactly like it, with every engine, and
+// truncated, corrupted or foreign states have to be rejected.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/vm.h"
+
+
+#define PROGNAME "catastrophic-chip8-state-test"
+
+#define CYCLES_PER_FRAME 11 // 700 Hz
+#define FRAMES           600
+
+
+static const uint32_t engines[] = {
+        CH8_VM_NO_OPTS, CH8_VM_NO_FUSION, CH8_VM_BLOCK_ENGINE, CH8_VM_JIT_ENGINE
+};
+
+
+//> Presses and releases keys following a fixed script, like the benchmark does. Engines
+//  only agree up to an unsupported opcode, so faulted vms aren't run any further.
+static void
+run_frames(CH8_VM *vm, long first, long n)
+{
+    for (long frame = first; frame < first + n; frame++) {
+        if (vm->internal_flags & CH8_VM_FAULT)
+            return;
+        CH8_VM_set_key(vm, (uint8_t)((frame / 23) % 16), (frame / 7) % 3 != 0);
+        CH8_VM_run_frame(vm, CYCLES_PER_FRAME);
+    }
+}
+
+
+//> Returns the name of the first check a rom fails, or NULL if it passes all.
+static const char *
+check_rom(const char *rom_fpath, const char *other_fpath)
+{
+    static uint8_t state[CH8_VM_STATE_MAX_SIZE], copy[CH8_VM_STATE_MAX_SIZE];
+    const char *failed = NULL;
+
+    CH8_VM *vm = CH8_VM_init(CH8_VM_NO_OPTS);
+    if (CH8_VM_load_rom(vm, rom_fpath) != CH8_VM_SUCCESS) {
+        CH8_VM_kill(vm);
+        return "load rom";
+    }
+
+    // save halfway, then run on to the end
+    run_frames(vm, 0, FRAMES / 2);
+    size_t size = CH8_VM_save_state(vm, state, sizeof(state));
+    uint64_t saved_hash = CH8_VM_state_hash(vm);
+    if (size == 0 || CH8_VM_save_state(vm, copy, size - 1) != 0)
+        failed = "save";
+
+    run_frames(vm, FRAMES / 2, FRAMES / 2);
+    uint64_t end_hash = CH8_VM_state_hash(vm);
+
+    for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]) && !failed; e++)
+    {
+        CH8_VM *restored = CH8_VM_init(engines[e]);
+        CH8_VM_load_rom(restored, rom_fpath);
+
+        if (CH8_VM_load_state(restored, state, size) != CH8_VM_SUCCESS)
+            failed = "load";
+        else if (CH8_VM_state_hash(restored) != saved_hash)
+            failed = "hash after loading";
+        else {
+            run_frames(restored, FRAMES / 2, FRAMES / 2);
+            if (CH8_VM_state_hash(restored) != end_hash)
+                failed = "hash after running on";
+        }
+        CH8_VM_kill(restored);
+    }
+
+    // invalid states leave the vm untouched
+    uint64_t hash = CH8_VM_state_hash(vm);
+    memcpy(copy, state, size);
+
+    for (size_t cut = 0; cut < size && !failed; cut += 7)
+        if (CH8_VM_load_state(vm, copy, cut) != CH8_VM_STATE_INVALID)
+            failed = "truncated state";
+
+    for (size_t pos = 0; pos < size && !failed; pos++) {
+        copy[pos] ^= 0x01u;
+        if (CH8_VM_load_state(vm, copy, size) != CH8_VM_STATE_INVALID)
+            failed = pos == 6 || pos == 7 ? "reserved header bytes" : "corrupted state";
+        copy[pos] ^= 0x01u;
+    }
+
+    if (!failed && CH8_VM_state_hash(vm) != hash)
+        failed = "vm changed by invalid states";
+
+    if (!failed && CH8_VM_load_rom(vm, other_fpath) == CH8_VM_SUCCESS &&
+        CH8_VM_load_state(vm, state, size) != CH8_VM_STATE_INVALID)
+        failed = "state of another rom";
+
+    CH8_VM_kill(vm);
+    return failed;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3) {
+        printf("Usage: %s <rom> <rom>...\n", PROGNAME);
+        return 1;
+    }
+
+    int exitcode = 0;
+    for (int r = 1; r < argc; r++)
+    {
+        // states are loaded into a vm with the next rom as well
+        const char *failed = check_rom(argv[r], argv[r % (argc - 1) + 1]);
+
+        printf("%-40s %s%s\n", argv[r], failed ? "failed: " : "ok", failed ? failed : "");
+        if (failed)
+            exitcode = 1;
+    }
+    return exitcode;
+}
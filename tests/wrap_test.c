@@ -0,0 +1,101 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+// Runs the roms of tests/roms, which store to and execute from addresses past the end
+// of memory, with every engine and checks that they wrap around to its start.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/vm.h"
+
+
+#define PROGNAME "catastrophic-chip8-wrap-test"
+
+
+typedef struct wrap_case {
+    const char *rom;
+    int         rc;   // result of running the rom
+    uint16_t    pc;   // program counter it stops at
+    uint8_t     x;    // register checked
+    uint8_t     value;
+} wrap_case;
+
+
+static const wrap_case cases[] = {
+        // Bnnn jumps to 0x10FE, from where the rom runs into its own code at 0x200
+        // again and counts the passes in V1
+        {"PC_PAST_END.ch8",    CH8_VM_SUCCESS,            0x208, 0x1, 0x02},
+        // Fx55 overwrites code at 0x000 it has called before, through I = 0x1000
+        {"WRAPPED_CODE.ch8",   CH8_VM_SUCCESS,            0x21C, 0x0, 0x2A},
+        // Fx55 overwrites the font through I = 0x1000 and jumps into it, faulting
+        // at its first glyph
+        {"STORE_PAST_END.ch8", CH8_VM_UNSUPPORTED_OPCODE, 0x052, 0x7, 0x41},
+};
+
+static const uint32_t engines[] = {
+        CH8_VM_NO_OPTS, CH8_VM_NO_FUSION, CH8_VM_BLOCK_ENGINE, CH8_VM_JIT_ENGINE
+};
+
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("Usage: %s <directory of the test roms>\n", PROGNAME);
+        return 1;
+    }
+
+    int failed = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+        for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); e++)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", argv[1], cases[c].rom);
+
+            CH8_VM *vm = CH8_VM_init(engines[e]);
+            if (CH8_VM_load_rom(vm, path) != CH8_VM_SUCCESS) {
+                printf("%-20s can't be loaded\n", cases[c].rom);
+                CH8_VM_kill(vm);
+                return 1;
+            }
+
+            int rc = CH8_VM_run(vm, 100000);
+            int ok = rc == cases[c].rc && vm->cpu.pc == cases[c].pc &&
+                     vm->cpu.V[cases[c].x] == cases[c].value;
+
+            printf("%-20s options 0x%02X %s\n", cases[c].rom, (unsigned) engines[e],
+                   ok ? "ok" : "failed");
+            if (!ok) {
+                printf("    rc %d pc 0x%03X V%X 0x%02X, expected rc %d pc 0x%03X V%X 0x%02X\n",
+                       rc, vm->cpu.pc, cases[c].x, vm->cpu.V[cases[c].x],
+                       cases[c].rc, cases[c].pc, cases[c].x, cases[c].value);
+                failed = 1;
+            }
+            CH8_VM_kill(vm);
+        }
+
+    return failed;
+}
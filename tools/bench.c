@@ -0,0 +1,739 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+// Headless benchmark comparing the instruction throughput of the available opcode
+// dispatch engines on a set of roms.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/vm.h"
+#include "../src/instructions.h"
+#include "../src/block.h"
+#include "../src/jit.h"
+#include "../src/debug.h"
+#include "../src/vm_bank.h"
+#include "../libs/argtable3.h"
+#include "../rf/mystdlib.h"
+
+
+#define PROGNAME "catastrophic-chip8-bench"
+
+#define NSECPERSEC    1000000000
+#define REGDECR_RATE  60 // rate in Hz at which timers should be decremented
+
+
+typedef struct bench_engine {
+    const char *name;
+    uint32_t    opt_flags; // options the vm is initialized with
+    int (*run)(CH8_VM *vm, uint64_t n_cycles); // executes n_cycles instructions
+} bench_engine;
+
+
+//> Fetches and executes n_cycles instructions with the nested switch dispatcher.
+static int
+run_switch(CH8_VM *vm, uint64_t n_cycles)
+{
+    for (uint64_t i = 0; i < n_cycles; i++) {
+        vm->current_opcode = vm->mem[vm->cpu.pc & 0x0FFFu] << 8 |
+                             vm->mem[(vm->cpu.pc + 1) & 0x0FFFu];
+        int rc = CH8_INSTR_exec_switch(vm);
+        vm->cpu.pc += 2; // past faulting instructions as well, like CH8_VM_run
+        vm->cycles++;
+        if (rc != CH8_VM_SUCCESS)
+            return CH8_VM_UNSUPPORTED_OPCODE;
+    }
+    return CH8_VM_SUCCESS;
+}
+
+
+//> Fetches and executes n_cycles instructions with the dispatch table.
+static int
+run_table(CH8_VM *vm, uint64_t n_cycles)
+{
+    for (uint64_t i = 0; i < n_cycles; i++) {
+        vm->current_opcode = vm->mem[vm->cpu.pc & 0x0FFFu] << 8 |
+                             vm->mem[(vm->cpu.pc + 1) & 0x0FFFu];
+        int rc = CH8_INSTR_exec_table(vm);
+        vm->cpu.pc += 2; // past faulting instructions as well, like CH8_VM_run
+        vm->cycles++;
+        if (rc != CH8_VM_SUCCESS)
+            return CH8_VM_UNSUPPORTED_OPCODE;
+    }
+    return CH8_VM_SUCCESS;
+}
+
+
+// The first engine serves as reference when verifying the others, as it executes
+// every instruction on its own. Engines executing through CH8_VM_run are selected by
+// the options of the vm.
+static const bench_engine engines[] = {
+        {"switch",  CH8_VM_NO_OPTS,      run_switch},
+        {"table",   CH8_VM_NO_OPTS,      run_table},
+        {"unfused", CH8_VM_NO_FUSION,    CH8_VM_run},
+        {"cached",  CH8_VM_NO_OPTS,      CH8_VM_run},
+        {"block",   CH8_VM_BLOCK_ENGINE, CH8_VM_run},
+        {"jit",     CH8_VM_JIT_ENGINE,   CH8_VM_run},
+};
+
+#define N_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+
+//> Returns whether an engine can run on this host.
+static int
+is_available(const bench_engine *engine)
+{
+    return !(engine->opt_flags & CH8_VM_JIT_ENGINE) || CH8_JIT_is_supported();
+}
+
+
+static double
+elapsed_sec(struct timespec start, struct timespec end)
+{
+    return (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / NSECPERSEC;
+}
+
+
+//> Runs a rom for n_cycles instructions and returns the achieved instructions per
+//  second, or a negative value if the rom could not be run to completion. Timers are
+//  decremented every clock_freq / 60 instructions, like they would be in real time.
+//  Engines stop a frame early once the rom is idle; the share of instructions skipped
+//  that way is stored in skipped.
+static double
+bench_rom(const bench_engine *engine, const char *rom_fpath,
+          size_t n_cycles, size_t clock_freq, double *skipped)
+{
+    size_t cycles_per_tick = clock_freq / REGDECR_RATE;
+    if (cycles_per_tick == 0)
+        cycles_per_tick = 1;
+
+    CH8_VM *vm = CH8_VM_init(engine->opt_flags);
+    if (CH8_VM_load_rom(vm, rom_fpath) != CH8_VM_SUCCESS) {
+        CH8_VM_kill(vm);
+        return -1.0;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int rc = CH8_VM_SUCCESS;
+    for (size_t done = 0; done < n_cycles && rc == CH8_VM_SUCCESS; done += cycles_per_tick) {
+        uint64_t frame_start = vm->cycles;
+        rc = engine->run(vm, cycles_per_tick);
+        if (vm->cycles - frame_start < cycles_per_tick)
+            vm->skipped_cycles += cycles_per_tick - (vm->cycles - frame_start);
+        CH8_VM_decrement_timers(vm);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t executed = vm->cycles;
+    *skipped = (double) vm->skipped_cycles / (double)(executed + vm->skipped_cycles);
+    CH8_VM_kill(vm);
+
+    if (rc != CH8_VM_SUCCESS)
+        return -1.0;
+    return (double) executed / elapsed_sec(start, end);
+}
+
+
+//> Returns whether the observable state of two vms is identical.
+static int
+vm_state_equals(const CH8_VM *a, const CH8_VM *b)
+{
+    return memcmp(&a->cpu, &b->cpu, sizeof(CH8_CPU)) == 0 &&
+           memcmp(&a->rng, &b->rng, sizeof(a->rng)) == 0 &&
+           memcmp(a->keypad, b->keypad, sizeof(a->keypad)) == 0 &&
+           memcmp(a->mem, b->mem, sizeof(a->mem)) == 0 &&
+           memcmp(a->display, b->display, sizeof(a->display)) == 0;
+}
+
+
+//> Runs an engine for up to n_cycles instructions and stops once the rom is idle or
+//  waits for a key press, like CH8_VM_run does. Engines that don't stop by themselves
+//  are run instruction by instruction.
+static int
+run_until_idle(const bench_engine *engine, CH8_VM *vm, uint64_t n_cycles)
+{
+    if (engine->run == CH8_VM_run)
+        return CH8_VM_run(vm, n_cycles);
+
+    if (vm->internal_flags & CH8_VM_WAIT_KEY) {
+        vm->internal_flags |= CH8_VM_IDLE;
+        return CH8_VM_SUCCESS;
+    }
+
+    vm->internal_flags &= ~CH8_VM_IDLE;
+    for (uint64_t i = 0; i < n_cycles; i++) {
+        int rc = engine->run(vm, 1);
+        if (rc != CH8_VM_SUCCESS)
+            return rc;
+        if (vm->internal_flags & CH8_VM_IDLE)
+            break;
+    }
+    return CH8_VM_SUCCESS;
+}
+
+
+//> Presses and releases keys following a fixed script, so roms leave their title
+//  screens and take paths that depend on input.
+static void
+script_input(long frame, uint8_t *key, int *pressed)
+{
+    *key     = (uint8_t)((frame / 23) % 16);
+    *pressed = (int)((frame / 7) % 3 != 0);
+}
+
+
+//> Runs a rom for n_frames frames with an engine and the reference engine side by side,
+//  pressing keys following script_input, and compares their state after every frame.
+//  Every engine has to execute exactly the same instructions per frame, so the vms
+//  are compared at equal instruction counts. Returns the number of the first frame in
+//  which the state diverged, or -1 if it never did.
+static long
+verify_rom(const bench_engine *engine, const char *rom_fpath,
+           long n_frames, size_t clock_freq)
+{
+    size_t cycles_per_tick = clock_freq / REGDECR_RATE;
+    if (cycles_per_tick == 0)
+        cycles_per_tick = 1;
+
+    CH8_VM *ref = CH8_VM_init(engines[0].opt_flags);
+    CH8_VM *vm  = CH8_VM_init(engine->opt_flags);
+    CH8_VM_load_rom(ref, rom_fpath);
+    CH8_VM_load_rom(vm, rom_fpath);
+
+    long diverged = -1;
+    for (long frame = 0; frame < n_frames && diverged < 0; frame++)
+    {
+        uint8_t key;
+        int pressed;
+        script_input(frame, &key, &pressed);
+        CH8_VM_set_key(ref, key, pressed);
+        CH8_VM_set_key(vm, key, pressed);
+
+        int rc     = run_until_idle(engine, vm, cycles_per_tick);
+        int ref_rc = run_until_idle(&engines[0], ref, cycles_per_tick);
+
+        if (rc != ref_rc || vm->cycles != ref->cycles || !vm_state_equals(ref, vm)) {
+            CH8_VM_DBG_output_cpu_dump(__func__, ref, "reference state:\n");
+            CH8_VM_DBG_output_cpu_dump(__func__, vm, "diverged state:\n");
+            diverged = frame;
+        }
+        if (rc != CH8_VM_SUCCESS)
+            break;
+
+        CH8_VM_decrement_timers(ref);
+        CH8_VM_decrement_timers(vm);
+    }
+
+    CH8_VM_kill(ref);
+    CH8_VM_kill(vm);
+    return diverged;
+}
+
+
+/*** Opcode pair histogram ********************************************************/
+
+
+// Instruction classes, identified by the handler of their opcodes
+static const struct {
+    CH8_INSTR_handler handler;
+    const char       *name;
+} classes[] = {
+        {CH8_INSTR_0nnn, "0nnn"}, {CH8_INSTR_00E0, "00E0"}, {CH8_INSTR_00EE, "00EE"},
+        {CH8_INSTR_1nnn, "1nnn"}, {CH8_INSTR_2nnn, "2nnn"}, {CH8_INSTR_3xkk, "3xkk"},
+        {CH8_INSTR_4xkk, "4xkk"}, {CH8_INSTR_5xy0, "5xy0"}, {CH8_INSTR_6xkk, "6xkk"},
+        {CH8_INSTR_7xkk, "7xkk"}, {CH8_INSTR_8xy0, "8xy0"}, {CH8_INSTR_8xy1, "8xy1"},
+        {CH8_INSTR_8xy2, "8xy2"}, {CH8_INSTR_8xy3, "8xy3"}, {CH8_INSTR_8xy4, "8xy4"},
+        {CH8_INSTR_8xy5, "8xy5"}, {CH8_INSTR_8xy6, "8xy6"}, {CH8_INSTR_8xy7, "8xy7"},
+        {CH8_INSTR_8xyE, "8xyE"}, {CH8_INSTR_9xy0, "9xy0"}, {CH8_INSTR_Annn, "Annn"},
+        {CH8_INSTR_Bnnn, "Bnnn"}, {CH8_INSTR_Cxkk, "Cxkk"}, {CH8_INSTR_Dxyn, "Dxyn"},
+        {CH8_INSTR_Ex9E, "Ex9E"}, {CH8_INSTR_ExA1, "ExA1"}, {CH8_INSTR_Fx07, "Fx07"},
+        {CH8_INSTR_Fx0A, "Fx0A"}, {CH8_INSTR_Fx15, "Fx15"}, {CH8_INSTR_Fx18, "Fx18"},
+        {CH8_INSTR_Fx1E, "Fx1E"}, {CH8_INSTR_Fx29, "Fx29"}, {CH8_INSTR_Fx33, "Fx33"},
+        {CH8_INSTR_Fx55, "Fx55"}, {CH8_INSTR_Fx65, "Fx65"}, {CH8_INSTR_F002, "F002"},
+        {CH8_INSTR_Fx3A, "Fx3A"},
+};
+
+#define N_CLASSES (sizeof(classes) / sizeof(classes[0]))
+#define N_TOP_PAIRS 20
+
+
+static int
+class_of(uint16_t opcode)
+{
+    CH8_INSTR_handler handler = CH8_INSTR_lookup(opcode);
+    for (size_t c = 0; c < N_CLASSES; c++)
+        if (classes[c].handler == handler)
+            return (int) c;
+    return -1;
+}
+
+
+//> Counts how often instructions of each class are directly followed by instructions
+//  of another class at the next address, i.e. the pairs a superinstruction could
+//  execute. Adds to pairs and returns the number of executed instructions.
+static uint64_t
+count_pairs(const char *rom_fpath, size_t n_cycles, size_t clock_freq,
+            uint64_t pairs[N_CLASSES][N_CLASSES], uint16_t samples[N_CLASSES])
+{
+    size_t cycles_per_tick = clock_freq / REGDECR_RATE;
+    if (cycles_per_tick == 0)
+        cycles_per_tick = 1;
+
+    CH8_VM *vm = CH8_VM_init(CH8_VM_NO_OPTS);
+    if (CH8_VM_load_rom(vm, rom_fpath) != CH8_VM_SUCCESS) {
+        CH8_VM_kill(vm);
+        return 0;
+    }
+
+    int      prev    = -1;
+    uint16_t prev_pc = 0;
+    for (size_t i = 0; i < n_cycles; i++)
+    {
+        uint16_t pc = vm->cpu.pc;
+        uint16_t opcode = vm->mem[pc & 0x0FFFu] << 8 | vm->mem[(pc + 1) & 0x0FFFu];
+        int cls = class_of(opcode);
+
+        if (cls >= 0) {
+            samples[cls] = opcode;
+            if (prev >= 0 && pc == prev_pc + 2)
+                pairs[prev][cls]++;
+        }
+        prev    = cls;
+        prev_pc = pc;
+
+        if (run_switch(vm, 1) != CH8_VM_SUCCESS)
+            break;
+        if ((i + 1) % cycles_per_tick == 0)
+            CH8_VM_decrement_timers(vm);
+    }
+
+    uint64_t executed = vm->cycles;
+    CH8_VM_kill(vm);
+    return executed;
+}
+
+
+//> Returns whether two instructions are fused into a superinstruction.
+static int
+is_fused(uint16_t first, uint16_t second)
+{
+    CH8_INSTR_decoded ops[2];
+    CH8_INSTR_decode(first, &ops[0]);
+    CH8_INSTR_decode(second, &ops[1]);
+    return CH8_INSTR_fuse(ops) == 2;
+}
+
+
+//> Prints the most frequent pairs of adjacent instructions over all roms, together
+//  with the share of dispatches a superinstruction for them saves.
+static void
+print_pairs(const struct arg_file *roms, size_t n_cycles, size_t clock_freq)
+{
+    static uint64_t pairs[N_CLASSES][N_CLASSES];
+    uint16_t samples[N_CLASSES] = {0};
+    uint64_t executed = 0;
+
+    for (int r = 0; r < roms->count; r++)
+        executed += count_pairs(roms->filename[r], n_cycles, clock_freq, pairs, samples);
+    if (executed == 0)
+        return;
+
+    printf("%-12s %14s %9s   %s\n", "pair", "count", "saved", "fused");
+    for (int i = 0; i < N_TOP_PAIRS; i++)
+    {
+        size_t best_a = 0, best_b = 0;
+        for (size_t a = 0; a < N_CLASSES; a++)
+            for (size_t b = 0; b < N_CLASSES; b++)
+                if (pairs[a][b] > pairs[best_a][best_b]) {
+                    best_a = a;
+                    best_b = b;
+                }
+        if (pairs[best_a][best_b] == 0)
+            break;
+
+        printf("%s %s    %14llu %8.2f%%   %s\n",
+               classes[best_a].name, classes[best_b].name,
+               (unsigned long long) pairs[best_a][best_b],
+               100.0 * (double) pairs[best_a][best_b] / (double) executed,
+               is_fused(samples[best_a], samples[best_b]) ? "yes" : "no");
+        pairs[best_a][best_b] = 0;
+    }
+}
+
+
+/*** Lockstep lanes ****************************************************************/
+
+
+//> Presses a different key in every lane every few frames, so lanes diverge like they
+//  would with independent inputs.
+static void
+lane_input(long frame, size_t lane, uint8_t *key, int *pressed)
+{
+    *key     = (uint8_t)((frame / 10 + (long) lane) % 16);
+    *pressed = (int)((frame / 5 + (long) lane) % 2);
+}
+
+
+//> Reads a rom into rom, which holds CH8_VM_MAX_PROGSIZE bytes. Returns its size, or 0
+//  if it could not be read.
+static size_t
+read_rom(const char *rom_fpath, uint8_t *rom)
+{
+    FILE *f = fopen(rom_fpath, "rb");
+    if (f == NULL)
+        return 0;
+    size_t size = fread(rom, 1, CH8_VM_MAX_PROGSIZE, f);
+    fclose(f);
+    return size;
+}
+
+
+//> Runs n_lanes copies of a rom for n_cycles instructions in total, once as a bank of
+//  lanes in lockstep and once as independent vms executing CH8_VM_emulate_cycle, and
+//  stores the achieved instructions per second of both. Neither fuses instructions, so
+//  both count every instruction of the rom. The share of lane instructions executed by
+//  loops over the lanes is stored in batched. Returns -1 if the rom could not be loaded.
+static int
+bench_lanes(const char *rom_fpath, size_t n_lanes, size_t n_cycles, size_t clock_freq,
+            double *bank_ips, double *independent_ips, double *batched)
+{
+    size_t cycles_per_tick = clock_freq / REGDECR_RATE;
+    if (cycles_per_tick == 0)
+        cycles_per_tick = 1;
+    long n_frames = (long)(n_cycles / n_lanes / cycles_per_tick) + 1;
+
+    uint8_t rom[CH8_VM_MAX_PROGSIZE];
+    size_t size = read_rom(rom_fpath, rom);
+    if (size == 0)
+        return -1;
+
+    CH8_VM_bank *bank = CH8_VM_bank_create(n_lanes, CH8_VM_NO_FUSION);
+    CH8_VM **vms = calloc(n_lanes, sizeof(CH8_VM *)); NP_CHECK(vms)
+    for (size_t i = 0; i < n_lanes; i++) {
+        vms[i] = CH8_VM_init(CH8_VM_NO_FUSION);
+        CH8_VM_load_rom_buffer(vms[i], rom, size);
+    }
+    CH8_VM_bank_load_rom_buffer(bank, rom, size);
+
+    struct timespec start, end;
+    uint8_t key;
+    int pressed;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long frame = 0; frame < n_frames; frame++) {
+        for (size_t i = 0; i < n_lanes; i++) {
+            lane_input(frame, i, &key, &pressed);
+            CH8_VM_bank_set_key(bank, i, key, pressed);
+        }
+        CH8_VM_bank_run_frame(bank, cycles_per_tick);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *bank_ips = (double)(bank->batched_lanes + bank->handler_lanes) / elapsed_sec(start, end);
+    *batched = (double) bank->batched_lanes /
+                  (double)(bank->batched_lanes + bank->handler_lanes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long frame = 0; frame < n_frames; frame++)
+        for (size_t i = 0; i < n_lanes; i++) {
+            lane_input(frame, i, &key, &pressed);
+            CH8_VM_set_key(vms[i], key, pressed);
+            for (size_t c = 0; c < cycles_per_tick; c++)
+                if (CH8_VM_emulate_cycle(vms[i]) != CH8_VM_SUCCESS)
+                    break;
+            CH8_VM_decrement_timers(vms[i]);
+        }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t executed = 0;
+    for (size_t i = 0; i < n_lanes; i++)
+        executed += vms[i]->cycles;
+    *independent_ips = (double) executed / elapsed_sec(start, end);
+
+    for (size_t i = 0; i < n_lanes; i++)
+        CH8_VM_kill(vms[i]);
+    free(vms);
+    CH8_VM_bank_destroy(bank);
+    return 0;
+}
+
+
+//> Runs n_lanes copies of a rom for n_frames frames as a bank of lanes and as
+//  independent vms with the same keys pressed, and compares the state of every lane
+//  with its vm after every frame. Returns the number of the first frame in which a lane
+//  diverged, or -1 if none did. The lane is stored in lane.
+static long
+verify_lanes(const char *rom_fpath, size_t n_lanes, long n_frames, size_t clock_freq,
+             size_t *lane)
+{
+    size_t cycles_per_tick = clock_freq / REGDECR_RATE;
+    if (cycles_per_tick == 0)
+        cycles_per_tick = 1;
+
+    uint8_t rom[CH8_VM_MAX_PROGSIZE];
+    size_t size = read_rom(rom_fpath, rom);
+    if (size == 0) {
+        *lane = 0;
+        return 0;
+    }
+
+    CH8_VM_bank *bank = CH8_VM_bank_create(n_lanes, CH8_VM_NO_FUSION);
+    CH8_VM **vms = calloc(n_lanes, sizeof(CH8_VM *)); NP_CHECK(vms)
+    for (size_t i = 0; i < n_lanes; i++) {
+        vms[i] = CH8_VM_init(CH8_VM_NO_FUSION);
+        CH8_VM_load_rom_buffer(vms[i], rom, size);
+    }
+    CH8_VM_bank_load_rom_buffer(bank, rom, size);
+
+    long diverged = -1;
+    for (long frame = 0; frame < n_frames && diverged < 0; frame++)
+    {
+        for (size_t i = 0; i < n_lanes; i++) {
+            uint8_t key;
+            int pressed;
+            lane_input(frame, i, &key, &pressed);
+            CH8_VM_bank_set_key(bank, i, key, pressed);
+            CH8_VM_set_key(vms[i], key, pressed);
+        }
+        CH8_VM_bank_run_frame(bank, cycles_per_tick);
+
+        for (size_t i = 0; i < n_lanes && diverged < 0; i++)
+        {
+            // a faulted lane stops, its vm has to as well
+            int faulted = (vms[i]->internal_flags & CH8_VM_FAULT) != 0;
+            for (size_t c = 0; c < cycles_per_tick && !faulted; c++)
+                faulted = CH8_VM_emulate_cycle(vms[i]) != CH8_VM_SUCCESS;
+            CH8_VM_decrement_timers(vms[i]);
+
+            CH8_VM *lane_vm = CH8_VM_bank_lane(bank, i);
+            if (faulted != CH8_VM_bank_is_faulted(bank, i) ||
+                !vm_state_equals(vms[i], lane_vm)) {
+                CH8_VM_DBG_output_cpu_dump(__func__, vms[i], "reference state:\n");
+                CH8_VM_DBG_output_cpu_dump(__func__, lane_vm, "diverged state:\n");
+                diverged = frame;
+                *lane    = i;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n_lanes; i++)
+        CH8_VM_kill(vms[i]);
+    free(vms);
+    CH8_VM_bank_destroy(bank);
+    return diverged;
+}
+
+
+/*** Command line parsing **********************************************************/
+
+
+struct arg_lit *help, *verify, *histogram;
+struct arg_int *cycles, *clockfreq, *lanes;
+struct arg_file *rom_fspecs;
+struct arg_end *end;
+
+int
+main(int argc, char **argv)
+{
+    int exitcode = 0;
+
+    void *argtable[] = {
+            help       = arg_litn("h", "help",
+                    0, 1, "display this help and exit"),
+
+            rom_fspecs = arg_filen(NULL, NULL, "<file>",
+                    1, 100, "roms to be benchmarked"),
+
+            cycles     = arg_intn(NULL, "cycles", "<int>",
+                    0, 1, "instructions executed per rom and engine (defaults to 10000000)"),
+
+            clockfreq  = arg_intn(NULL, "cpufreq", "<int>",
+                    0, 1, "emulated clock frequency, used to pace timers (defaults to 700)"),
+
+            verify     = arg_litn(NULL, "verify",
+                    0, 1, "compare the state of every engine with the first one each frame "
+                          "instead of measuring throughput, or of every lane with an "
+                          "independent vm with --lanes"),
+
+            histogram  = arg_litn(NULL, "pairs",
+                    0, 1, "print the most frequent pairs of adjacent instructions "
+                          "instead of measuring throughput"),
+
+            lanes      = arg_intn(NULL, "lanes", "<int>",
+                    0, 1, "compare a bank of that many lanes running in lockstep with as "
+                          "many independent vms instead of the engines"),
+
+            end        = arg_end(20)
+    };
+
+    cycles->ival[0]    = 10000000;
+    clockfreq->ival[0] = 700;
+
+    int nerrors = arg_parse(argc, argv, argtable);
+
+    if (help->count > 0)
+    {
+        printf("Usage: %s", PROGNAME);
+        arg_print_syntax(stdout, argtable, "\n");
+        printf("Options and arguments: \n\n");
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+        goto EXIT;
+    }
+
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end, PROGNAME);
+        printf("Try '%s --help' for more information.\n", PROGNAME);
+        exitcode = 1;
+        goto EXIT;
+    }
+
+    if (histogram->count > 0)
+    {
+        print_pairs(rom_fspecs, (size_t) cycles->ival[0], (size_t) clockfreq->ival[0]);
+        goto EXIT;
+    }
+
+    if (verify->count > 0 && lanes->count > 0)
+    {
+        if (lanes->ival[0] <= 0) {
+            printf("%s: --lanes must be positive\n", PROGNAME);
+            exitcode = 1;
+            goto EXIT;
+        }
+
+        size_t frames_per_rom = cycles->ival[0] / (clockfreq->ival[0] / REGDECR_RATE + 1);
+
+        for (int r = 0; r < rom_fspecs->count; r++) {
+            size_t lane;
+            long frame = verify_lanes(rom_fspecs->filename[r], (size_t) lanes->ival[0],
+                                      (long) frames_per_rom, (size_t) clockfreq->ival[0],
+                                      &lane);
+            if (frame >= 0) {
+                printf("%-16s %-8s diverged in frame %ld, lane %zu\n",
+                       rom_fspecs->basename[r], "bank", frame, lane);
+                exitcode = 1;
+            } else {
+                printf("%-16s %-8s ok\n", rom_fspecs->basename[r], "bank");
+            }
+        }
+        goto EXIT;
+    }
+
+    if (verify->count > 0)
+    {
+        size_t frames_per_rom = cycles->ival[0] / (clockfreq->ival[0] / REGDECR_RATE + 1);
+
+        for (int r = 0; r < rom_fspecs->count; r++)
+            for (size_t e = 1; e < N_ENGINES; e++) {
+                if (!is_available(&engines[e]))
+                    continue;
+
+                long frame = verify_rom(&engines[e], rom_fspecs->filename[r],
+                                        (long) frames_per_rom, (size_t) clockfreq->ival[0]);
+                if (frame >= 0) {
+                    printf("%-16s %-8s diverged in frame %ld\n",
+                           rom_fspecs->basename[r], engines[e].name, frame);
+                    exitcode = 1;
+                } else {
+                    printf("%-16s %-8s ok\n", rom_fspecs->basename[r], engines[e].name);
+                }
+            }
+        goto EXIT;
+    }
+
+    if (lanes->count > 0)
+    {
+        if (lanes->ival[0] <= 0) {
+            printf("%s: --lanes must be positive\n", PROGNAME);
+            exitcode = 1;
+            goto EXIT;
+        }
+
+        printf("%-16s %12s %12s %9s   (million instructions per second of all lanes, "
+               "share of lane instructions batched)\n", "rom", "bank", "independent",
+               "batched");
+        for (int r = 0; r < rom_fspecs->count; r++)
+        {
+            double bank_ips, independent_ips, batched;
+            printf("%-16s", rom_fspecs->basename[r]);
+            if (bench_lanes(rom_fspecs->filename[r], (size_t) lanes->ival[0],
+                            (size_t) cycles->ival[0], (size_t) clockfreq->ival[0],
+                            &bank_ips, &independent_ips, &batched) < 0) {
+                printf(" %12s\n", "failed");
+                exitcode = 1;
+                continue;
+            }
+            printf(" %12.2f %12.2f %8.1f%%\n", bank_ips / 1e6, independent_ips / 1e6,
+                   100.0 * batched);
+        }
+        goto EXIT;
+    }
+
+    printf("%-16s", "rom");
+    for (size_t e = 0; e < N_ENGINES; e++)
+        printf(" %12s", engines[e].name);
+    printf(" %9s   (million instructions per second, share of idle instructions skipped)\n",
+           "skipped");
+
+    double totals[N_ENGINES] = {0};
+    for (int r = 0; r < rom_fspecs->count; r++)
+    {
+        double skipped = 0.0;
+
+        printf("%-16s", rom_fspecs->basename[r]);
+        for (size_t e = 0; e < N_ENGINES; e++) {
+            if (!is_available(&engines[e])) {
+                printf(" %12s", "n/a");
+                continue;
+            }
+            double ips = bench_rom(&engines[e], rom_fspecs->filename[r],
+                                   (size_t) cycles->ival[0], (size_t) clockfreq->ival[0],
+                                   &skipped);
+            if (ips < 0) {
+                printf(" %12s", "failed");
+                exitcode = 1;
+            } else {
+                printf(" %12.2f", ips / 1e6);
+                totals[e] += ips;
+            }
+        }
+        printf(" %8.1f%%\n", 100.0 * skipped); // as skipped by the last engine
+    }
+
+    printf("%-16s", "mean");
+    for (size_t e = 0; e < N_ENGINES; e++)
+        printf(" %12.2f", totals[e] / rom_fspecs->count / 1e6);
+    printf("\n");
+
+    EXIT:
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return exitcode;
+}
@@ -0,0 +1,553 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/vm.h"
+#include "../src/instructions.h"
+#include "../libs/argtable3.h"
+
+
+#define PROGNAME "catastrophic-chip8-aot"
+
+#define X(opcode)   (((opcode) & 0x0F00u) >> 8u)
+#define Y(opcode)   (((opcode) & 0x00F0u) >> 4u)
+#define KK(opcode)  ((opcode) & 0x00FFu)
+#define NNN(opcode) ((opcode) & 0x0FFFu)
+
+
+// Rom being translated and what is known about its control flow
+typedef struct aot_rom {
+    uint8_t  mem[CH8_VM_MEM_SIZE];
+    uint16_t end; // address after the last byte of the rom
+
+    uint8_t is_leader[CH8_VM_MEM_SIZE];  // a block of translated code starts here
+    uint8_t is_visited[CH8_VM_MEM_SIZE]; // an instruction starting here has been decoded
+    uint8_t is_code[CH8_VM_MEM_SIZE];    // the byte is part of a decoded instruction
+} aot_rom;
+
+
+static int
+in_rom(const aot_rom *rom, uint32_t addr)
+{
+    return addr >= CH8_VM_PROGRAM_START_ADDR && addr + 1 < rom->end;
+}
+
+
+static uint16_t
+fetch(const aot_rom *rom, uint16_t addr)
+{
+    return (uint16_t)(rom->mem[addr] << 8u | rom->mem[addr + 1]);
+}
+
+
+//> Returns whether the instruction changes the program counter or writes to memory,
+//  so the code following it is entered through a label.
+static int
+ends_block(CH8_INSTR_handler h)
+{
+    return h == NULL || h == CH8_INSTR_00EE || h == CH8_INSTR_1nnn ||
+           h == CH8_INSTR_2nnn || h == CH8_INSTR_3xkk || h == CH8_INSTR_4xkk ||
+           h == CH8_INSTR_5xy0 || h == CH8_INSTR_9xy0 || h == CH8_INSTR_Bnnn ||
+           h == CH8_INSTR_Ex9E || h == CH8_INSTR_ExA1 || h == CH8_INSTR_Fx0A ||
+           h == CH8_INSTR_Fx33 || h == CH8_INSTR_Fx55;
+}
+
+
+static int
+is_skip(CH8_INSTR_handler h)
+{
+    return h == CH8_INSTR_3xkk || h == CH8_INSTR_4xkk || h == CH8_INSTR_5xy0 ||
+           h == CH8_INSTR_9xy0 || h == CH8_INSTR_Ex9E || h == CH8_INSTR_ExA1;
+}
+
+
+//> Walks all code reachable from the program start and marks the addresses at which
+//  blocks start. Targets of Bnnn and 00EE are only known at runtime; return addresses
+//  are covered as successors of the calls, everything else is left to the
+//  interpreter.
+static void
+build_cfg(aot_rom *rom)
+{
+    static uint16_t worklist[CH8_VM_MEM_SIZE];
+    size_t n_work = 0;
+
+    worklist[n_work++] = CH8_VM_PROGRAM_START_ADDR;
+    rom->is_leader[CH8_VM_PROGRAM_START_ADDR] = 1;
+
+    while (n_work > 0)
+    {
+        uint16_t addr = worklist[--n_work];
+
+        while (in_rom(rom, addr) && !rom->is_visited[addr])
+        {
+            uint16_t opcode = fetch(rom, addr);
+            CH8_INSTR_handler h = CH8_INSTR_lookup(opcode);
+
+            rom->is_visited[addr] = 1;
+            rom->is_code[addr] = rom->is_code[addr + 1] = 1;
+
+            uint16_t succ[2];
+            int n_succ = 0;
+
+            if (h == CH8_INSTR_1nnn) {
+                succ[n_succ++] = NNN(opcode);
+            } else if (h == CH8_INSTR_2nnn) {
+                succ[n_succ++] = NNN(opcode);
+                succ[n_succ++] = addr + 2;
+            } else if (is_skip(h)) {
+                succ[n_succ++] = addr + 2;
+                succ[n_succ++] = addr + 4;
+            } else if (h == CH8_INSTR_Fx0A) {
+                rom->is_leader[addr] = 1; // executed again until a key is pressed
+                succ[n_succ++] = addr + 2;
+            } else if (h == CH8_INSTR_Fx33 || h == CH8_INSTR_Fx55) {
+                succ[n_succ++] = addr + 2;
+            }
+
+            for (int i = 0; i < n_succ; i++)
+                if (in_rom(rom, succ[i]) && !rom->is_leader[succ[i]]) {
+                    rom->is_leader[succ[i]] = 1;
+                    worklist[n_work++] = succ[i];
+                }
+
+            if (ends_block(h))
+                break;
+            addr += 2;
+        }
+    }
+}
+
+
+/*** C code generation **************************************************************/
+
+
+static const char *
+handler_name(CH8_INSTR_handler h)
+{
+    if (h == CH8_INSTR_00E0) return "CH8_INSTR_00E0";
+    if (h == CH8_INSTR_Bnnn) return "CH8_INSTR_Bnnn";
+    if (h == CH8_INSTR_Cxkk) return "CH8_INSTR_Cxkk";
+    if (h == CH8_INSTR_Dxyn) return "CH8_INSTR_Dxyn";
+    if (h == CH8_INSTR_Fx0A) return "CH8_INSTR_Fx0A";
+    if (h == CH8_INSTR_Fx33) return "CH8_INSTR_Fx33";
+    if (h == CH8_INSTR_Fx55) return "CH8_INSTR_Fx55";
+    if (h == CH8_INSTR_Fx65) return "CH8_INSTR_Fx65";
+    if (h == CH8_INSTR_F002) return "CH8_INSTR_F002";
+    return "CH8_INSTR_unsupported";
+}
+
+
+//> Emits a call of the interpreter's implementation of an instruction.
+static void
+emit_call(FILE *out, CH8_INSTR_handler h, uint16_t opcode)
+{
+    fprintf(out, "    { static const CH8_INSTR_decoded op = OP(%s, 0x%04X); %s(vm, &op); }\n",
+            handler_name(h), opcode, handler_name(h));
+}
+
+
+//> Emits the exit of a block with n_instr instructions to a known address.
+static void
+emit_exit(FILE *out, const aot_rom *rom, const char *indent, int n_instr, uint16_t target)
+{
+    if (in_rom(rom, target) && rom->is_leader[target])
+        fprintf(out, "%sJUMP(%d, 0x%03X);\n", indent, n_instr, target);
+    else
+        fprintf(out, "%s{ cpu->pc = 0x%03X; DISPATCH(%d); }\n", indent, target, n_instr);
+}
+
+
+//> Emits the check of a jump from addr to target for an idle loop, which stops the run
+//  like CH8_INSTR_1nnn does: a jump to itself, or a loop polling the delay timer with
+//  Fx07, 3x00. The code of the loop is known, so only the timer is checked at runtime.
+//  Returns whether the jump always stops the run.
+static int
+emit_idle_check(FILE *out, const aot_rom *rom, uint16_t addr, uint16_t target, int n_instr)
+{
+    if (target == addr) {
+        fprintf(out, "    IDLE(%d, 0x%03X);\n", n_instr, target);
+        return 1;
+    }
+    if (target + 4 != addr || !in_rom(rom, target) || !in_rom(rom, target + 2))
+        return 0;
+
+    const uint8_t *loop = &rom->mem[target];
+    if ((loop[0] & 0xF0u) == 0xF0 && loop[1] == 0x07 &&
+        loop[2] == (0x30u | (loop[0] & 0x0Fu)) && loop[3] == 0x00)
+        fprintf(out, "    if (cpu->delay_timer > 0)\n        IDLE(%d, 0x%03X);\n",
+                n_instr, target);
+    return 0;
+}
+
+
+//> Emits a single instruction of a block. Instructions that end the block also emit
+//  the exit of the block.
+static void
+emit_instr(FILE *out, const aot_rom *rom, const char *prog, uint16_t addr, int n_instr)
+{
+    uint16_t opcode = fetch(rom, addr);
+    CH8_INSTR_handler h = CH8_INSTR_lookup(opcode);
+    unsigned int x = X(opcode), y = Y(opcode), kk = KK(opcode), nnn = NNN(opcode);
+
+    fprintf(out, "    // %03X: %04X\n", addr, opcode);
+
+    if (h == CH8_INSTR_0nnn) {
+        // ignored, like the interpreter does
+    }
+    else if (h == CH8_INSTR_6xkk) {
+        fprintf(out, "    cpu->V[0x%X] = 0x%02X;\n", x, kk);
+    }
+    else if (h == CH8_INSTR_7xkk) {
+        fprintf(out, "    cpu->V[0x%X] += 0x%02X;\n", x, kk);
+    }
+    else if (h == CH8_INSTR_8xy0) {
+        fprintf(out, "    cpu->V[0x%X] = cpu->V[0x%X];\n", x, y);
+    }
+    else if (h == CH8_INSTR_8xy1 || h == CH8_INSTR_8xy2 || h == CH8_INSTR_8xy3) {
+        const char *op = h == CH8_INSTR_8xy1 ? "|=" : h == CH8_INSTR_8xy2 ? "&=" : "^=";
+        fprintf(out, "    cpu->V[0x%X] %s cpu->V[0x%X];\n", x, op, y);
+    }
+    else if (h == CH8_INSTR_8xy4) {
+        fprintf(out, "    { uint16_t r = cpu->V[0x%X] + cpu->V[0x%X]; "
+                     "cpu->V[0xF] = r > 0xFFu; cpu->V[0x%X] = (uint8_t) r; }\n", x, y, x);
+    }
+    else if (h == CH8_INSTR_8xy5) {
+        fprintf(out, "    cpu->V[0xF] = cpu->V[0x%X] >= cpu->V[0x%X]; "
+                     "cpu->V[0x%X] -= cpu->V[0x%X];\n", x, y, x, y);
+    }
+    else if (h == CH8_INSTR_8xy6) {
+        fprintf(out, "    cpu->V[0xF] = cpu->V[0x%X] & 0x01u; cpu->V[0x%X] >>= 1u;\n", x, x);
+    }
+    else if (h == CH8_INSTR_8xy7) {
+        fprintf(out, "    cpu->V[0xF] = cpu->V[0x%X] >= cpu->V[0x%X]; "
+                     "cpu->V[0x%X] = cpu->V[0x%X] - cpu->V[0x%X];\n", y, x, x, y, x);
+    }
+    else if (h == CH8_INSTR_8xyE) {
+        fprintf(out, "    cpu->V[0xF] = cpu->V[0x%X] >> 7u; cpu->V[0x%X] <<= 1u;\n", x, x);
+    }
+    else if (h == CH8_INSTR_Annn) {
+        fprintf(out, "    cpu->I = 0x%03X;\n", nnn);
+    }
+    else if (h == CH8_INSTR_Fx07) {
+        fprintf(out, "    cpu->V[0x%X] = cpu->delay_timer;\n", x);
+    }
+    else if (h == CH8_INSTR_Fx15) {
+        fprintf(out, "    cpu->delay_timer = cpu->V[0x%X];\n", x);
+    }
+    else if (h == CH8_INSTR_Fx18) {
+        fprintf(out, "    cpu->sound_timer = cpu->V[0x%X];\n", x);
+    }
+    else if (h == CH8_INSTR_Fx1E) {
+        fprintf(out, "    cpu->V[0xF] = cpu->I + cpu->V[0x%X] > 0x0FFF; "
+                     "cpu->I += cpu->V[0x%X];\n", x, x);
+    }
+    else if (h == CH8_INSTR_Fx29) {
+        fprintf(out, "    cpu->I = CH8_VM_FONTSET_START_ADDR + cpu->V[0x%X] * 5;\n", x);
+    }
+    else if (h == CH8_INSTR_00E0 || h == CH8_INSTR_Cxkk ||
+             h == CH8_INSTR_Dxyn || h == CH8_INSTR_Fx65 || h == CH8_INSTR_F002) {
+        emit_call(out, h, opcode);
+    }
+    else if (h == CH8_INSTR_Fx3A) {
+        fprintf(out, "    vm->pitch = cpu->V[0x%X];\n", x);
+    }
+    else if (h == CH8_INSTR_1nnn) {
+        if (!emit_idle_check(out, rom, addr, nnn, n_instr))
+            emit_exit(out, rom, "    ", n_instr, nnn);
+    }
+    else if (h == CH8_INSTR_2nnn) {
+        fprintf(out, "    cpu->stack[cpu->sp & 0x0F] = 0x%03X; cpu->sp = (cpu->sp + 1) & 0x0F;\n", addr);
+        emit_exit(out, rom, "    ", n_instr, nnn);
+    }
+    else if (h == CH8_INSTR_00EE) {
+        fprintf(out, "    cpu->sp = (cpu->sp - 1) & 0x0F; cpu->pc = cpu->stack[cpu->sp] + 2; DISPATCH(%d);\n", n_instr);
+    }
+    else if (is_skip(h)) {
+        if (h == CH8_INSTR_3xkk)
+            fprintf(out, "    if (cpu->V[0x%X] == 0x%02X)\n", x, kk);
+        else if (h == CH8_INSTR_4xkk)
+            fprintf(out, "    if (cpu->V[0x%X] != 0x%02X)\n", x, kk);
+        else if (h == CH8_INSTR_5xy0)
+            fprintf(out, "    if (cpu->V[0x%X] == cpu->V[0x%X])\n", x, y);
+        else if (h == CH8_INSTR_9xy0)
+            fprintf(out, "    if (cpu->V[0x%X] != cpu->V[0x%X])\n", x, y);
+        else if (h == CH8_INSTR_Ex9E)
+            fprintf(out, "    if (vm->keypad[cpu->V[0x%X] & 0x0F])\n", x);
+        else
+            fprintf(out, "    if (!vm->keypad[cpu->V[0x%X] & 0x0F])\n", x);
+        emit_exit(out, rom, "        ", n_instr, addr + 4);
+        emit_exit(out, rom, "    ", n_instr, addr + 2);
+    }
+    else if (h == CH8_INSTR_Bnnn || h == CH8_INSTR_Fx0A) {
+        // the implementation computes the next program counter itself
+        fprintf(out, "    cpu->pc = 0x%03X;\n", addr);
+        emit_call(out, h, opcode);
+        fprintf(out, "    cpu->pc += 2; DISPATCH(%d);\n", n_instr);
+    }
+    else if (h == CH8_INSTR_Fx33 || h == CH8_INSTR_Fx55) {
+        // the rom may overwrite its own code, which is checked before continuing
+        fprintf(out, "    { uint16_t i = cpu->I;\n  ");
+        emit_call(out, h, opcode);
+        fprintf(out, "      CH8_AOT_check_store(vm, &%s, i, %u); }\n",
+                prog, h == CH8_INSTR_Fx33 ? 3u : x + 1u);
+        fprintf(out, "    cpu->pc = 0x%03X; DISPATCH(%d);\n", addr + 2, n_instr);
+    }
+    else {
+        emit_call(out, NULL, opcode);
+        fprintf(out, "    cpu->pc = 0x%03X; vm->cycles += %d;\n", addr + 2, n_instr);
+        fprintf(out, "    return CH8_VM_UNSUPPORTED_OPCODE;\n");
+    }
+}
+
+
+//> Returns the number of instructions of the block starting at addr.
+static int
+block_length(const aot_rom *rom, uint16_t addr)
+{
+    int n_instr = 0;
+    while (in_rom(rom, addr)) {
+        n_instr++;
+        if (ends_block(CH8_INSTR_lookup(fetch(rom, addr))) ||
+            (in_rom(rom, addr + 2) && rom->is_leader[addr + 2]))
+            break;
+        addr += 2;
+    }
+    return n_instr;
+}
+
+
+//> Emits the block starting at addr. The block ends with the first instruction that
+//  ends a block, or falls through to the next block.
+static void
+emit_block(FILE *out, const aot_rom *rom, const char *prog, uint16_t addr)
+{
+    fprintf(out, "\n    L_0x%03X:\n", addr);
+
+    int length = block_length(rom, addr);
+    if (length > 1)
+        fprintf(out, "    if (end - vm->cycles < %d)\n        goto finish;\n", length);
+
+    for (int n_instr = 1; ; n_instr++, addr += 2)
+    {
+        if (!in_rom(rom, addr)) {
+            // runs off the end of the rom, which is left to the interpreter
+            fprintf(out, "    cpu->pc = 0x%03X; DISPATCH(%d);\n", addr, n_instr - 1);
+            return;
+        }
+
+        emit_instr(out, rom, prog, addr, n_instr);
+        if (ends_block(CH8_INSTR_lookup(fetch(rom, addr))))
+            return;
+
+        if (in_rom(rom, addr + 2) && rom->is_leader[addr + 2]) {
+            emit_exit(out, rom, "    ", n_instr, addr + 2);
+            return;
+        }
+    }
+}
+
+
+static void
+emit_program(FILE *out, const aot_rom *rom, const char *rom_name, const char *name)
+{
+    char prog[128];
+    snprintf(prog, sizeof(prog), "CH8_AOT_%s", name);
+
+    fprintf(out, "// Generated by %s from %s. Do not edit.\n\n", PROGNAME, rom_name);
+    fprintf(out, "#include \"vm.h\"\n#include \"instructions.h\"\n#include \"aot.h\"\n\n");
+
+    fprintf(out, "#define OP(handler, opcode) { handler, opcode, (opcode) & 0x0FFFu, "
+                 "(opcode) >> 8u & 0xFu, \\\n"
+                 "                              (opcode) >> 4u & 0xFu, (opcode) & 0xFu, 1, "
+                 "(opcode) & 0xFFu }\n\n");
+    fprintf(out, "// leaves a block to the block at target, unless enough cycles have run\n");
+    fprintf(out, "#define JUMP(n_instr, target) do { vm->cycles += (n_instr); cpu->pc = (target); \\\n"
+                 "        if (vm->cycles < end) { goto L_##target; } return CH8_VM_SUCCESS; } while (0)\n\n");
+    fprintf(out, "// leaves a block to the address in the program counter\n");
+    fprintf(out, "#define DISPATCH(n_instr) do { vm->cycles += (n_instr); goto dispatch; } while (0)\n\n");
+    fprintf(out, "// leaves a block to the start of an idle loop and stops the run\n");
+    fprintf(out, "#define IDLE(n_instr, target) do { vm->cycles += (n_instr); cpu->pc = (target); \\\n"
+                 "        vm->internal_flags |= CH8_VM_IDLE; return CH8_VM_SUCCESS; } while (0)\n\n");
+
+    fprintf(out, "static int run(CH8_VM *vm, uint64_t n_cycles);\n\n");
+
+    fprintf(out, "static const uint8_t rom[%u] = {", rom->end - CH8_VM_PROGRAM_START_ADDR);
+    for (uint32_t a = CH8_VM_PROGRAM_START_ADDR; a < rom->end; a++)
+        fprintf(out, "%s0x%02X,", (a - CH8_VM_PROGRAM_START_ADDR) % 12 ? " " : "\n    ", rom->mem[a]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static const uint8_t is_code[%u] = {", CH8_VM_MEM_SIZE / 8);
+    for (uint32_t i = 0; i < CH8_VM_MEM_SIZE / 8; i++) {
+        unsigned int bits = 0;
+        for (uint32_t b = 0; b < 8; b++)
+            bits |= (unsigned int) rom->is_code[i * 8 + b] << b;
+        fprintf(out, "%s0x%02X,", i % 12 ? " " : "\n    ", bits);
+    }
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "const CH8_AOT_program %s = {\"%s\", rom, sizeof(rom), is_code, run};\n\n\n",
+            prog, name);
+
+    fprintf(out, "static int\nrun(CH8_VM *vm, uint64_t n_cycles)\n{\n");
+    fprintf(out, "    CH8_CPU *cpu = &vm->cpu;\n");
+    fprintf(out, "    uint64_t end = vm->cycles + n_cycles;\n");
+    fprintf(out, "    vm->internal_flags &= ~CH8_VM_IDLE;\n\n");
+    fprintf(out, "    dispatch:\n");
+    fprintf(out, "    if (vm->cycles >= end)\n        return CH8_VM_SUCCESS;\n");
+    fprintf(out, "    if (vm->internal_flags & (CH8_VM_AOT_STALE | CH8_VM_WAIT_KEY))\n"
+                 "        return CH8_VM_run(vm, end - vm->cycles);\n\n");
+    fprintf(out, "    switch (cpu->pc) {\n");
+    for (uint32_t a = 0; a < CH8_VM_MEM_SIZE; a++)
+        if (rom->is_leader[a])
+            fprintf(out, "        case 0x%03X: goto L_0x%03X;\n", a, a);
+    fprintf(out, "        default: {\n");
+    fprintf(out, "            int rc = CH8_AOT_interpret(vm, &%s);\n", prog);
+    fprintf(out, "            if (rc != CH8_VM_SUCCESS || (vm->internal_flags & CH8_VM_IDLE))\n"
+                 "                return rc;\n");
+    fprintf(out, "            goto dispatch;\n        }\n    }\n");
+
+    // blocks that don't fit into the rest of the budget are interpreted up to its end,
+    // so the run executes exactly n_cycles instructions like CH8_VM_run
+    fprintf(out, "\n    finish: __attribute__((unused));\n");
+    fprintf(out, "    while (vm->cycles < end) {\n");
+    fprintf(out, "        int rc = CH8_AOT_interpret(vm, &%s);\n", prog);
+    fprintf(out, "        if (rc != CH8_VM_SUCCESS || (vm->internal_flags & CH8_VM_IDLE))\n"
+                 "            return rc;\n");
+    fprintf(out, "    }\n    return CH8_VM_SUCCESS;\n");
+
+    for (uint32_t a = 0; a < CH8_VM_MEM_SIZE; a++)
+        if (rom->is_leader[a])
+            emit_block(out, rom, prog, (uint16_t) a);
+
+    fprintf(out, "}\n");
+}
+
+
+//> Derives a C identifier from the file name of a rom, e.g. PONG2.ch8 -> pong2.
+static void
+name_from_file(char *name, size_t size, const char *basename)
+{
+    size_t n = 0;
+    if (isdigit((unsigned char) basename[0]) && n + 1 < size)
+        name[n++] = '_';
+    for (const char *c = basename; *c && *c != '.' && n + 1 < size; c++)
+        name[n++] = isalnum((unsigned char) *c) ? (char) tolower((unsigned char) *c) : '_';
+    name[n] = '\0';
+}
+
+
+/*** Command line parsing ***********************************************************/
+
+
+struct arg_lit *help;
+struct arg_str *name;
+struct arg_file *rom_fspec, *output;
+struct arg_end *end;
+
+int
+main(int argc, char **argv)
+{
+    int exitcode = 0;
+
+    void *argtable[] = {
+            help      = arg_litn("h", "help",
+                    0, 1, "display this help and exit"),
+
+            rom_fspec = arg_filen(NULL, NULL, "<file>",
+                    1, 1, "rom to be translated"),
+
+            output    = arg_filen("o", "output", "<file>",
+                    0, 1, "C file to be written (defaults to stdout)"),
+
+            name      = arg_strn(NULL, "name", "<name>",
+                    0, 1, "program is exported as CH8_AOT_<name> (defaults to the rom's name)"),
+
+            end       = arg_end(20)
+    };
+
+    int nerrors = arg_parse(argc, argv, argtable);
+
+    if (help->count > 0)
+    {
+        printf("Usage: %s", PROGNAME);
+        arg_print_syntax(stdout, argtable, "\n");
+        printf("Options and arguments: \n\n");
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+        goto EXIT;
+    }
+
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end, PROGNAME);
+        printf("Try '%s --help' for more information.\n", PROGNAME);
+        exitcode = 1;
+        goto EXIT;
+    }
+
+    static aot_rom rom;
+    FILE *rom_fp = fopen(rom_fspec->filename[0], "rb");
+    if (rom_fp == NULL) {
+        fprintf(stderr, "%s: rom could not be opened: %s\n", PROGNAME, rom_fspec->filename[0]);
+        exitcode = 1;
+        goto EXIT;
+    }
+    // one byte more than fits is read to detect roms that are too large
+    static uint8_t buffer[CH8_VM_MAX_PROGSIZE + 1];
+    size_t sz = fread(buffer, 1, sizeof(buffer), rom_fp);
+    fclose(rom_fp);
+    if (sz == 0 || sz > CH8_VM_MAX_PROGSIZE) {
+        fprintf(stderr, "%s: rom size out of bounds: %zu bytes\n", PROGNAME, sz);
+        exitcode = 1;
+        goto EXIT;
+    }
+    memcpy(rom.mem + CH8_VM_PROGRAM_START_ADDR, buffer, sz);
+    rom.end = (uint16_t)(CH8_VM_PROGRAM_START_ADDR + sz);
+
+    char prog_name[64];
+    if (name->count > 0)
+        snprintf(prog_name, sizeof(prog_name), "%s", name->sval[0]);
+    else
+        name_from_file(prog_name, sizeof(prog_name), rom_fspec->basename[0]);
+
+    FILE *out = stdout;
+    if (output->count > 0 && (out = fopen(output->filename[0], "w")) == NULL) {
+        fprintf(stderr, "%s: output could not be opened: %s\n", PROGNAME, output->filename[0]);
+        exitcode = 1;
+        goto EXIT;
+    }
+
+    build_cfg(&rom);
+    emit_program(out, &rom, rom_fspec->basename[0], prog_name);
+
+    if (out != stdout)
+        fclose(out);
+
+    EXIT:
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return exitcode;
+}
@@ -0,0 +1,590 @@
+/*******************************************************************************
+ *
+ * MIT License
+ * Copyright (c) 2019 Roland Fuhrmann
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ ******************************************************************************/
+
+// Runs a manifest of jobs on a pool of worker threads and reports the final state hash
+// and run time of every job, e.g. for regression checks over many roms. Each line of
+// the manifest describes one job:
+//
+//   <rom> <instructions> [<input script> | -] [<seed>]
+//
+// An input script lists key events as "<frame> <key> <pressed>" lines in ascending
+// order of frames, with the key in hex, e.g. "120 5 1" presses key 5 in frame 120.
+// Lines starting with '#' are ignored in both files.
+//
+// With --audio=<dir>, the sound of job j is recorded in emulated time to <dir>/<j>.wav.
+
+#define _POSIX_C_SOURCE 200809L // strdup, sysconf, snprintf
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../src/vm.h"
+#include "../src/timing.h"
+#include "../src/audio.h"
+#include "../rf/mystdlib.h"
+#include "../libs/argtable3.h"
+
+
+#define PROGNAME "catastrophic-chip8-batch"
+
+#define REGDECR_RATE  60   // rate in Hz at which timers should be decremented
+#define MAX_LINE      1024 // longest line of a manifest or input script
+
+#define AUDIO_SAMPLE_RATE 44100 // sound recorded with --audio
+#define AUDIO_FREQ        440
+#define AUDIO_AMPLITUDE   20000
+
+
+// Key event of an input script
+typedef struct batch_input {
+    uint64_t frame;
+    uint8_t  key;
+    uint8_t  pressed;
+} batch_input;
+
+
+// Rom or input script, loaded once and shared by all jobs referring to it
+typedef struct batch_file {
+    char   *path;
+    void   *data;
+    size_t  size; // bytes of a rom, events of an input script
+} batch_file;
+
+
+typedef struct batch_job {
+    const batch_file *rom;
+    const batch_file *script; // NULL if no keys are pressed
+    uint64_t cycles;          // instructions to run, including the ones skipped while idle
+    uint32_t seed;
+
+    int      rc;              // results
+    uint64_t hash;
+    uint64_t executed;
+    uint64_t skipped;
+    uint64_t ns;
+} batch_job;
+
+
+struct batch_pool;
+
+// Worker thread owning a range of queued jobs. Once its own range is done, it steals
+// half of the jobs left in the range of another worker.
+typedef struct batch_worker {
+    pthread_t       thread;
+    pthread_mutex_t lock;   // guards next and end
+    size_t          next;   // jobs [next, end) are queued on this worker
+    size_t          end;
+    size_t          id;
+    size_t          steals;
+    CH8_VM         *vm;     // reused for every job the worker runs
+    CH8_AUDIO_recorder recorder;
+    struct batch_pool *pool;
+} batch_worker;
+
+
+typedef struct batch_pool {
+    batch_job     *jobs;
+    size_t         n_jobs;
+    batch_worker **workers; // allocated one by one, so their locks don't share cache lines
+    size_t         n_workers;
+    uint32_t       vm_opts;
+    uint64_t       cycles_per_frame;
+    const char    *audio_dir;   // NULL if no sound is recorded
+    int            audio_format;
+} batch_pool;
+
+
+/*** Manifest *********************************************************************/
+
+
+//> Reads a whole rom file into memory. Returns 0 on success.
+static int
+load_rom(batch_file *file)
+{
+    FILE *fp = fopen(file->path, "rb");
+    if (fp == NULL)
+        return -1;
+
+    file->data = malloc(CH8_VM_MAX_PROGSIZE + 1); NP_CHECK(file->data)
+    file->size = fread(file->data, 1, CH8_VM_MAX_PROGSIZE + 1, fp);
+    fclose(fp);
+
+    return file->size > CH8_VM_MAX_PROGSIZE ? -1 : 0;
+}
+
+
+//> Reads the key events of an input script. Returns 0 on success.
+static int
+load_script(batch_file *file)
+{
+    FILE *fp = fopen(file->path, "r");
+    if (fp == NULL)
+        return -1;
+
+    size_t capacity = 64;
+    batch_input *events = malloc(capacity * sizeof(*events)); NP_CHECK(events)
+    char line[MAX_LINE];
+    int rc = 0;
+
+    file->size = 0;
+    while (rc == 0 && fgets(line, sizeof(line), fp))
+    {
+        unsigned long long frame;
+        unsigned int key, pressed;
+
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+        if (sscanf(line, "%llu %x %u", &frame, &key, &pressed) != 3 || key > 0xF ||
+            (file->size > 0 && frame < events[file->size - 1].frame)) {
+            rc = -1;
+            break;
+        }
+
+        if (file->size == capacity) {
+            capacity *= 2;
+            events = realloc(events, capacity * sizeof(*events)); NP_CHECK(events)
+        }
+        events[file->size++] = (batch_input) {
+                .frame = frame, .key = (uint8_t) key, .pressed = pressed ? 1 : 0 };
+    }
+    fclose(fp);
+
+    file->data = events;
+    return rc;
+}
+
+
+//> Returns the file loaded from path, loading it first if no job referred to it yet.
+//  Returns NULL if it can't be loaded.
+static const batch_file *
+get_file(batch_file **files, size_t *n_files, const char *path, int (*load)(batch_file *))
+{
+    for (size_t i = 0; i < *n_files; i++)
+        if (strcmp((*files)[i].path, path) == 0)
+            return &(*files)[i];
+
+    batch_file file = { .path = strdup(path) }; NP_CHECK(file.path)
+    if (load(&file) != 0) {
+        fprintf(stderr, "%s: can't load %s\n", PROGNAME, path);
+        free(file.path);
+        free(file.data);
+        return NULL;
+    }
+
+    *files = realloc(*files, (*n_files + 1) * sizeof(**files)); NP_CHECK(*files)
+    (*files)[*n_files] = file;
+    return &(*files)[(*n_files)++];
+}
+
+
+//> Parses a manifest into jobs. Returns the number of jobs, or -1 on errors.
+static long
+parse_manifest(const char *path, batch_job **jobs,
+               batch_file **roms, size_t *n_roms, batch_file **scripts, size_t *n_scripts)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: can't open manifest %s\n", PROGNAME, path);
+        return -1;
+    }
+
+    // files are referred to by index while parsing, as the arrays may still move
+    typedef struct { size_t rom, script; } refs;
+    refs *job_refs = NULL;
+
+    char line[MAX_LINE];
+    long n_jobs = 0;
+    int  lineno = 0;
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        char rom[MAX_LINE], script[MAX_LINE] = "-";
+        unsigned long long cycles;
+        unsigned long seed = 0;
+
+        lineno++;
+        if (line[0] == '#' || strspn(line, " \t\r\n") == strlen(line))
+            continue;
+
+        if (sscanf(line, "%1023s %llu %1023s %lu", rom, &cycles, script, &seed) < 2) {
+            fprintf(stderr, "%s: %s:%d: expected <rom> <instructions> [<input script>] [<seed>]\n",
+                    PROGNAME, path, lineno);
+            n_jobs = -1;
+            break;
+        }
+
+        const batch_file *r = get_file(roms, n_roms, rom, load_rom);
+        const batch_file *s = strcmp(script, "-") == 0 ? NULL :
+                              get_file(scripts, n_scripts, script, load_script);
+        if (r == NULL || (s == NULL && strcmp(script, "-") != 0)) {
+            n_jobs = -1;
+            break;
+        }
+
+        *jobs    = realloc(*jobs, (n_jobs + 1) * sizeof(**jobs)); NP_CHECK(*jobs)
+        job_refs = realloc(job_refs, (n_jobs + 1) * sizeof(*job_refs)); NP_CHECK(job_refs)
+
+        (*jobs)[n_jobs] = (batch_job) { .cycles = cycles, .seed = (uint32_t) seed };
+        job_refs[n_jobs] = (refs) {
+                .rom    = (size_t)(r - *roms),
+                .script = s ? (size_t)(s - *scripts) : SIZE_MAX };
+        n_jobs++;
+    }
+    fclose(fp);
+
+    for (long j = 0; j < n_jobs; j++) {
+        (*jobs)[j].rom    = &(*roms)[job_refs[j].rom];
+        (*jobs)[j].script = job_refs[j].script == SIZE_MAX ? NULL : &(*scripts)[job_refs[j].script];
+    }
+    free(job_refs);
+    return n_jobs;
+}
+
+
+/*** Worker pool ******************************************************************/
+
+
+//> Opens the file the sound of job j is recorded to and starts recording. Returns NULL
+//  if the file can't be opened.
+static FILE *
+start_recording(batch_worker *worker, size_t j)
+{
+    const batch_pool *pool = worker->pool;
+    char path[MAX_LINE];
+    snprintf(path, sizeof(path), "%s/%zu.%s", pool->audio_dir, j,
+             pool->audio_format == CH8_AUDIO_RAW ? "pcm" : "wav");
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL || CH8_AUDIO_record_start(&worker->recorder, fp, pool->audio_format,
+                                             AUDIO_SAMPLE_RATE, AUDIO_FREQ, AUDIO_AMPLITUDE) != 0)
+    {
+        fprintf(stderr, "%s: can't record to %s\n", PROGNAME, path);
+        if (fp)
+            fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+
+//> Runs a job on the vm of a worker, applying the key events of its input script at
+//  the start of their frames.
+static void
+run_job(batch_worker *worker, batch_job *job)
+{
+    CH8_VM *vm = worker->vm;
+    uint64_t start = CH8_TIMING_now_ns();
+
+    FILE *audio = NULL;
+    if (worker->pool->audio_dir)
+        audio = start_recording(worker, (size_t) (job - worker->pool->jobs));
+
+    CH8_VM_reset(vm, worker->pool->vm_opts);
+    CH8_VM_seed(vm, job->seed);
+    job->rc = CH8_VM_load_rom_buffer(vm, job->rom->data, job->rom->size);
+
+    const batch_input *events = job->script ? job->script->data : NULL;
+    size_t n_events = job->script ? job->script->size : 0;
+    size_t e = 0;
+
+    for (uint64_t frame = 0; job->rc == CH8_VM_SUCCESS; frame++)
+    {
+        uint64_t done = vm->cycles + vm->skipped_cycles;
+        if (done >= job->cycles)
+            break;
+
+        for (; e < n_events && events[e].frame <= frame; e++)
+            CH8_VM_set_key(vm, events[e].key, events[e].pressed);
+
+        uint64_t n_cycles = worker->pool->cycles_per_frame;
+        if (n_cycles > job->cycles - done)
+            n_cycles = job->cycles - done;
+
+        job->rc = CH8_VM_run_frame(vm, n_cycles);
+        if (audio)
+            CH8_AUDIO_record_frame(&worker->recorder, vm);
+    }
+
+    if (audio) {
+        if (CH8_AUDIO_record_stop(&worker->recorder) != 0)
+            fprintf(stderr, "%s: recording the sound of %s failed\n", PROGNAME, job->rom->path);
+        fclose(audio);
+    }
+
+    job->hash     = CH8_VM_state_hash(vm);
+    job->executed = vm->cycles;
+    job->skipped  = vm->skipped_cycles;
+    job->ns       = CH8_TIMING_now_ns() - start;
+}
+
+
+//> Takes the next job of a worker, stealing from the other workers once its own
+//  jobs are done. Returns 0 if no jobs are left.
+static int
+take_job(batch_worker *self, size_t *job)
+{
+    pthread_mutex_lock(&self->lock);
+    int found = self->next < self->end;
+    if (found)
+        *job = self->next++;
+    pthread_mutex_unlock(&self->lock);
+
+    if (found)
+        return 1;
+
+    // take the upper half of the jobs left to the first worker that has any. Jobs are
+    // never added, so once every worker is out of jobs the pool is done.
+    batch_pool *pool = self->pool;
+    for (size_t i = 1; i < pool->n_workers; i++)
+    {
+        batch_worker *victim = pool->workers[(self->id + i) % pool->n_workers];
+
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->next;
+        size_t end  = victim->end;
+        size_t mid  = end - (left + 1) / 2;
+        if (left > 0)
+            victim->end = mid;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (left > 0) {
+            pthread_mutex_lock(&self->lock);
+            self->next = mid + 1;
+            self->end  = end;
+            pthread_mutex_unlock(&self->lock);
+
+            self->steals++;
+            *job = mid;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static void *
+worker_main(void *arg)
+{
+    batch_worker *self = arg;
+    size_t job;
+
+    while (take_job(self, &job))
+        run_job(self, &self->pool->jobs[job]);
+
+    return NULL;
+}
+
+
+//> Runs all jobs on n_workers threads. The jobs are split into equal ranges upfront.
+static void
+run_pool(batch_pool *pool)
+{
+    for (size_t w = 0; w < pool->n_workers; w++)
+    {
+        batch_worker *worker = calloc(1, sizeof(*worker)); NP_CHECK(worker)
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->id   = w;
+        worker->pool = pool;
+        worker->next = pool->n_jobs * w / pool->n_workers;
+        worker->end  = pool->n_jobs * (w + 1) / pool->n_workers;
+        worker->vm   = CH8_VM_init(pool->vm_opts);
+        pool->workers[w] = worker;
+    }
+
+    for (size_t w = 0; w < pool->n_workers; w++)
+        pthread_create(&pool->workers[w]->thread, NULL, worker_main, pool->workers[w]);
+
+    for (size_t w = 0; w < pool->n_workers; w++)
+        pthread_join(pool->workers[w]->thread, NULL);
+}
+
+
+/*** Command line parsing **********************************************************/
+
+
+struct arg_lit  *help;
+struct arg_file *manifest, *output, *audio_dir;
+struct arg_int  *threads, *clockfreq;
+struct arg_str  *engine, *audio_format;
+struct arg_end  *end;
+
+int
+main(int argc, char **argv)
+{
+    int exitcode = 0;
+
+    void *argtable[] = {
+            help      = arg_litn("h", "help",
+                    0, 1, "display this help and exit"),
+
+            manifest  = arg_filen(NULL, NULL, "<manifest>",
+                    1, 1, "jobs to be run, one \"<rom> <instructions> [<input script>] [<seed>]\" per line"),
+
+            output    = arg_filen("o", "output", "<file>",
+                    0, 1, "file the results are written to (defaults to stdout)"),
+
+            threads   = arg_intn(NULL, "threads", "<int>",
+                    0, 1, "worker threads (defaults to the number of online cpus)"),
+
+            clockfreq = arg_intn(NULL, "cpufreq", "<int>",
+                    0, 1, "emulated clock frequency, used to pace timers (defaults to 700)"),
+
+            engine    = arg_strn(NULL, "engine", "<name>",
+                    0, 1, "cached, block or jit (defaults to cached)"),
+
+            audio_dir = arg_filen(NULL, "audio", "<dir>",
+                    0, 1, "record the sound of job j to <dir>/<j>.wav"),
+
+            audio_format = arg_strn(NULL, "audio-format", "<name>",
+                    0, 1, "wav or raw 16-bit pcm (defaults to wav)"),
+
+            end       = arg_end(20)
+    };
+
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads->ival[0]   = n_cpus > 0 ? (int) n_cpus : 1;
+    clockfreq->ival[0] = 700;
+    engine->sval[0]    = "cached";
+    audio_format->sval[0] = "wav";
+
+    int nerrors = arg_parse(argc, argv, argtable);
+
+    if (help->count > 0)
+    {
+        printf("Usage: %s", PROGNAME);
+        arg_print_syntax(stdout, argtable, "\n");
+        printf("Options and arguments: \n\n");
+        arg_print_glossary(stdout, argtable, "  %-25s %s\n");
+        goto EXIT;
+    }
+
+    if (nerrors > 0)
+    {
+        arg_print_errors(stdout, end, PROGNAME);
+        printf("Try '%s --help' for more information.\n", PROGNAME);
+        exitcode = 1;
+        goto EXIT;
+    }
+
+    batch_pool pool = {
+            .n_workers        = threads->ival[0] > 0 ? (size_t) threads->ival[0] : 1,
+            .cycles_per_frame = clockfreq->ival[0] / REGDECR_RATE > 0 ?
+                                (uint64_t) clockfreq->ival[0] / REGDECR_RATE : 1
+    };
+
+    if (strcmp(engine->sval[0], "block") == 0)
+        pool.vm_opts = CH8_VM_BLOCK_ENGINE;
+    else if (strcmp(engine->sval[0], "jit") == 0)
+        pool.vm_opts = CH8_VM_BLOCK_ENGINE | CH8_VM_JIT_ENGINE;
+    else if (strcmp(engine->sval[0], "cached") != 0) {
+        fprintf(stderr, "%s: unknown engine %s\n", PROGNAME, engine->sval[0]);
+        exitcode = 1;
+        goto EXIT;
+    }
+
+    if (audio_dir->count > 0)
+        pool.audio_dir = audio_dir->filename[0];
+
+    if (strcmp(audio_format->sval[0], "raw") == 0)
+        pool.audio_format = CH8_AUDIO_RAW;
+    else if (strcmp(audio_format->sval[0], "wav") != 0) {
+        fprintf(stderr, "%s: unknown audio format %s\n", PROGNAME, audio_format->sval[0]);
+        exitcode = 1;
+        goto EXIT;
+    }
+
+    batch_file *roms = NULL, *scripts = NULL;
+    size_t n_roms = 0, n_scripts = 0;
+
+    long n_jobs = parse_manifest(manifest->filename[0], &pool.jobs,
+                                 &roms, &n_roms, &scripts, &n_scripts);
+    if (n_jobs < 0) {
+        exitcode = 1;
+        goto FREE;
+    }
+    pool.n_jobs = (size_t) n_jobs;
+
+    FILE *out = output->count > 0 ? fopen(output->filename[0], "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "%s: can't open %s\n", PROGNAME, output->filename[0]);
+        exitcode = 1;
+        goto FREE;
+    }
+
+    /*** Run the jobs */
+
+    pool.workers = calloc(pool.n_workers, sizeof(*pool.workers)); NP_CHECK(pool.workers)
+
+    uint64_t start = CH8_TIMING_now_ns();
+    run_pool(&pool);
+    uint64_t wall_ns = CH8_TIMING_now_ns() - start;
+
+    fprintf(out, "# job\trom\tinstructions\tseed\trc\thash\texecuted\tskipped\tms\n");
+
+    uint64_t total = 0;
+    for (size_t j = 0; j < pool.n_jobs; j++)
+    {
+        const batch_job *job = &pool.jobs[j];
+        fprintf(out, "%zu\t%s\t%llu\t%u\t%d\t%016llx\t%llu\t%llu\t%.3f\n",
+                j, job->rom->path, (unsigned long long) job->cycles, job->seed, job->rc,
+                (unsigned long long) job->hash, (unsigned long long) job->executed,
+                (unsigned long long) job->skipped, (double) job->ns / 1e6);
+
+        total += job->executed;
+        if (job->rc != CH8_VM_SUCCESS)
+            exitcode = 1;
+    }
+
+    size_t steals = 0;
+    for (size_t w = 0; w < pool.n_workers; w++) {
+        steals += pool.workers[w]->steals;
+        CH8_VM_kill(pool.workers[w]->vm);
+        pthread_mutex_destroy(&pool.workers[w]->lock);
+        free(pool.workers[w]);
+    }
+    free(pool.workers);
+
+    fprintf(stderr, "%zu jobs on %zu threads in %.3f s, %.2f million instructions per second, "
+                    "%zu steals\n",
+            pool.n_jobs, pool.n_workers, (double) wall_ns / 1e9,
+            (double) total / ((double) wall_ns / 1e3), steals);
+
+    if (out != stdout)
+        fclose(out);
+
+    FREE:
+    for (size_t i = 0; i < n_roms; i++) { free(roms[i].path); free(roms[i].data); }
+    for (size_t i = 0; i < n_scripts; i++) { free(scripts[i].path); free(scripts[i].data); }
+    free(roms);
+    free(scripts);
+    free(pool.jobs);
+
+    EXIT:
+    arg_freetable(argtable, sizeof(argtable) / sizeof(argtable[0]));
+    return exitcode;
+}